@@ -0,0 +1,63 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cstdint>
+#include <cmath>
+
+//One asteroid of the belt in 16 bytes, its transform rebuilt by Shaders/Asteroid.vs. Positions
+//are in belt space: the belt turns about Y as one body (BeltRotation), so culling data built
+//from these never goes stale, the frustum is moved into belt space instead. Each rock also
+//spins about its own axis, which only the shader knows (from rotationSeed).
+struct AsteroidInstance
+{
+	float orbitRadius;		//Distance from the Y axis
+	float phase;			//Angle around Y in radians, sin gives x and cos z
+	uint16_t height;		//Half float y
+	uint16_t scale;			//Half float uniform scale
+	uint32_t rotationSeed;	//Spin axis, speed and starting angle
+
+	static AsteroidInstance Make(const glm::vec3& position, float scale, uint32_t rotationSeed)
+	{
+		AsteroidInstance instance;
+		instance.orbitRadius = std::sqrt(position.x * position.x + position.z * position.z);
+		instance.phase = std::atan2(position.x, position.z);
+		instance.height = glm::packHalf1x16(position.y);
+		instance.scale = glm::packHalf1x16(scale);
+		instance.rotationSeed = rotationSeed;
+		return instance;
+	}
+
+	//Belt space bounding sphere (xyz center, w radius) for a mesh whose vertices lie within
+	//meshRadius of its origin, the point it spins about
+	glm::vec4 GetSphere(float meshRadius) const
+	{
+		float y = glm::unpackHalf1x16(height);
+		return glm::vec4(std::sin(phase) * orbitRadius, y, std::cos(phase) * orbitRadius, meshRadius * glm::unpackHalf1x16(scale));
+	}
+
+	//Belt space to world space at time, matching Asteroid.vs
+	static glm::mat4 BeltRotation(float time, float orbitSpeed)
+	{
+		return glm::rotate(glm::mat4(1.0f), time * orbitSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	//Instance attributes 3 to 5 of the bound VAO from the bound GL_ARRAY_BUFFER
+	static void SetupAttributes()
+	{
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)0);
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(2 * sizeof(float)));
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, sizeof(AsteroidInstance), (void*)(3 * sizeof(float)));
+
+		glVertexAttribDivisor(3, 1);
+		glVertexAttribDivisor(4, 1);
+		glVertexAttribDivisor(5, 1);
+	}
+};
+
+static_assert(sizeof(AsteroidInstance) == 16, "AsteroidInstance is read by Asteroid.vs and the culling passes as 16 bytes");
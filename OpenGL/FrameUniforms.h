@@ -0,0 +1,134 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+//std140 mirrors of the uniform blocks in the shaders (Shaders/Model2.fs). vec3s are followed by
+//a float so every member sits where std140 puts it.
+struct CameraBlock
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float padding;
+};
+
+struct DirLightBlock
+{
+	glm::vec3 direction;
+	float padding0;
+	glm::vec3 ambient;
+	float padding1;
+	glm::vec3 diffuse;
+	float padding2;
+	glm::vec3 specular;
+	float padding3;
+};
+
+struct PointLightBlock
+{
+	glm::vec3 position;
+	float constant;
+	glm::vec3 ambient;
+	float linear;
+	glm::vec3 diffuse;
+	float quadratic;
+	glm::vec3 specular;
+	float padding;
+};
+
+struct SpotLightBlock
+{
+	glm::vec3 position;
+	float constant;
+	glm::vec3 direction;
+	float linear;
+	glm::vec3 ambient;
+	float quadratic;
+	glm::vec3 diffuse;
+	float cutOff;
+	glm::vec3 specular;
+	float outerCutOff;
+};
+
+const unsigned int POINT_LIGHT_COUNT = 1; //NR_POINTS_LIGHTS in the shaders
+
+struct LightsBlock
+{
+	DirLightBlock dirLight;
+	PointLightBlock pointLights[POINT_LIGHT_COUNT];
+	SpotLightBlock spotLight;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 Camera block");
+static_assert(sizeof(LightsBlock) == 64 + 64 * POINT_LIGHT_COUNT + 80, "LightsBlock must match the std140 Lights block");
+
+//Per frame camera and light data shared by every program. Written once a frame into one uniform
+//buffer, so the uniform traffic no longer grows with the number of shaders on screen.
+//Shader binds its "Camera" and "Lights" blocks to the binding points below when it links.
+class FrameUniforms
+{
+public:
+	static const GLuint CAMERA_BINDING = 0;
+	static const GLuint LIGHTS_BINDING = 1;
+
+	static FrameUniforms& Get()
+	{
+		static FrameUniforms uniforms;
+		return uniforms;
+	}
+
+	//GL thread, once per frame before drawing
+	void Update(const CameraBlock& camera, const LightsBlock& lights)
+	{
+		if (!_buffer)
+			initialise();
+
+		unsigned char staging[sizeof(CameraBlock) + sizeof(LightsBlock) + 256];
+		std::memcpy(staging, &camera, sizeof(CameraBlock));
+		std::memcpy(staging + _lightsOffset, &lights, sizeof(LightsBlock));
+		glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, _lightsOffset + sizeof(LightsBlock), staging);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	//Points program's blocks at the shared binding points, programs without them are left alone
+	static void BindBlocks(GLuint program)
+	{
+		GLuint camera = glGetUniformBlockIndex(program, "Camera");
+		if (camera != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, camera, CAMERA_BINDING);
+		GLuint lights = glGetUniformBlockIndex(program, "Lights");
+		if (lights != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, lights, LIGHTS_BINDING);
+	}
+
+private:
+	FrameUniforms() : _buffer(0), _lightsOffset(0)
+	{
+	}
+	FrameUniforms(const FrameUniforms&) = delete;
+	FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+	GLuint _buffer;
+	GLsizeiptr _lightsOffset;
+
+	//One buffer, the lights range starts at the next offset the driver accepts for a binding
+	void initialise()
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		if (alignment <= 0 || alignment > 256)
+			alignment = 256;
+		_lightsOffset = (sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+
+		glGenBuffers(1, &_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+		glBufferData(GL_UNIFORM_BUFFER, _lightsOffset + sizeof(LightsBlock), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BINDING, _buffer, 0, sizeof(CameraBlock));
+		glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING, _buffer, _lightsOffset, sizeof(LightsBlock));
+	}
+};
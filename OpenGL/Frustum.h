@@ -0,0 +1,79 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+//View frustum as six inward facing planes (xyz normal, w distance), taken from a
+//projection * view matrix. Tests are conservative: boxes and spheres near an edge may be
+//reported visible, nothing visible is ever rejected.
+class Frustum
+{
+public:
+	//Everything visible until a matrix is set. The planes face everything too, for code that
+	//reads them directly.
+	Frustum() : _all(true)
+	{
+		for (int i = 0; i < 6; i++)
+			_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	explicit Frustum(const glm::mat4& viewProjection) : _all(false)
+	{
+		//Gribb/Hartmann: each plane is the last row plus or minus another row
+		glm::vec4 rows[4];
+		for (int row = 0; row < 4; row++)
+			rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+		_planes[0] = rows[3] + rows[0]; //Left
+		_planes[1] = rows[3] - rows[0]; //Right
+		_planes[2] = rows[3] + rows[1]; //Bottom
+		_planes[3] = rows[3] - rows[1]; //Top
+		_planes[4] = rows[3] + rows[2]; //Near
+		_planes[5] = rows[3] - rows[2]; //Far
+		for (int i = 0; i < 6; i++)
+			_planes[i] /= glm::length(glm::vec3(_planes[i]));
+	}
+
+	//Sphere in object space, drawn with model
+	bool IntersectsSphere(const glm::vec3& center, float radius, const glm::mat4& model) const
+	{
+		if (_all)
+			return true;
+		glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+		float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+		float worldRadius = radius * scale;
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(_planes[i]), worldCenter) + _planes[i].w < -worldRadius)
+				return false;
+		}
+		return true;
+	}
+
+	//Object space box drawn with model, tested as the oriented box it becomes
+	bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& model) const
+	{
+		if (_all)
+			return true;
+		glm::vec3 center = glm::vec3(model * glm::vec4((boxMin + boxMax) * 0.5f, 1.0f));
+		glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+		glm::vec3 axes[3] = { glm::vec3(model[0]) * extent.x, glm::vec3(model[1]) * extent.y, glm::vec3(model[2]) * extent.z };
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 normal = glm::vec3(_planes[i]);
+			float reach = std::abs(glm::dot(normal, axes[0])) + std::abs(glm::dot(normal, axes[1])) + std::abs(glm::dot(normal, axes[2]));
+			if (glm::dot(normal, center) + _planes[i].w < -reach)
+				return false;
+		}
+		return true;
+	}
+
+	//Plane i (Left, Right, Bottom, Top, Near, Far): points with dot(xyz, p) + w < 0 are outside
+	const glm::vec4& GetPlane(int i) const { return _planes[i]; }
+
+private:
+	glm::vec4 _planes[6];
+	bool _all;
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+
+//Shadow copy of the GL binding and fixed function state the renderer changes. Every bind and
+//toggle goes through here and is only passed to the driver when it changes something. Anything
+//that binds behind its back (or deletes a bound object without the Delete* calls below) has to
+//call Invalidate, or a later bind may be skipped while the driver holds something else.
+class GLState
+{
+public:
+	static const unsigned int TEXTURE_UNITS = 16;
+
+	//Calls passed to the driver and calls filtered out
+	struct Counters
+	{
+		unsigned int issued;
+		unsigned int skipped;
+	};
+
+	static GLState& Get()
+	{
+		static GLState state;
+		return state;
+	}
+
+	//Once a frame, before drawing: keeps this frame's counters for GetLastFrame and starts over
+	void BeginFrame()
+	{
+		_lastFrame = _frame;
+		_frame.issued = 0;
+		_frame.skipped = 0;
+	}
+
+	const Counters& GetLastFrame() const { return _lastFrame; }
+
+	//Forget everything, the next call of each kind reaches the driver
+	void Invalidate()
+	{
+		_program = UNKNOWN;
+		_vertexArray = UNKNOWN;
+		_arrayBuffer = UNKNOWN;
+		_activeUnit = UNKNOWN;
+		for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++)
+		{
+			for (unsigned int target = 0; target < TARGET_COUNT; target++)
+				_textures[unit][target] = UNKNOWN;
+		}
+		for (unsigned int cap = 0; cap < CAP_COUNT; cap++)
+			_caps[cap] = UNKNOWN;
+		_depthFunc = UNKNOWN;
+		_blendSource = UNKNOWN;
+		_blendDestination = UNKNOWN;
+	}
+
+	void UseProgram(GLuint program)
+	{
+		if (filter(_program, program))
+			glUseProgram(program);
+	}
+
+	void BindVertexArray(GLuint vertexArray)
+	{
+		if (filter(_vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	//GL_ARRAY_BUFFER only. Element buffers belong to the bound VAO, other targets aren't tracked.
+	void BindArrayBuffer(GLuint buffer)
+	{
+		if (filter(_arrayBuffer, buffer))
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	}
+
+	//unit is 0 based, not GL_TEXTURE0 + unit
+	void ActiveTexture(unsigned int unit)
+	{
+		if (filter(_activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	//Binds on the active unit, as glBindTexture does (uploads)
+	void BindTexture(GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		if (slot < 0 || _activeUnit >= TEXTURE_UNITS)
+		{
+			issue();
+			glBindTexture(target, texture);
+			return;
+		}
+		if (filter(_textures[_activeUnit][slot], texture))
+			glBindTexture(target, texture);
+	}
+
+	//Binds on unit, only switching the active unit when the binding actually changes
+	void BindTexture(unsigned int unit, GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		if (slot >= 0 && unit < TEXTURE_UNITS && _textures[unit][slot] == texture)
+		{
+			_frame.skipped++;
+			return;
+		}
+		ActiveTexture(unit);
+		BindTexture(target, texture);
+	}
+
+	void Enable(GLenum cap) { setCap(cap, true); }
+	void Disable(GLenum cap) { setCap(cap, false); }
+
+	void DepthFunc(GLenum func)
+	{
+		if (filter(_depthFunc, func))
+			glDepthFunc(func);
+	}
+
+	void BlendFunc(GLenum source, GLenum destination)
+	{
+		if (_blendSource == source && _blendDestination == destination)
+		{
+			_frame.skipped++;
+			return;
+		}
+		_blendSource = source;
+		_blendDestination = destination;
+		issue();
+		glBlendFunc(source, destination);
+	}
+
+	//Deleting a bound object resets its bindings to 0, and its name may come back from glGen*
+	void DeleteTexture(GLuint texture)
+	{
+		for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++)
+		{
+			for (unsigned int target = 0; target < TARGET_COUNT; target++)
+			{
+				if (_textures[unit][target] == texture)
+					_textures[unit][target] = 0;
+			}
+		}
+		glDeleteTextures(1, &texture);
+	}
+
+	void DeleteBuffer(GLuint buffer)
+	{
+		if (_arrayBuffer == buffer)
+			_arrayBuffer = 0;
+		glDeleteBuffers(1, &buffer);
+	}
+
+private:
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+	static const unsigned int TARGET_COUNT = 3;
+	static const unsigned int CAP_COUNT = 3;
+
+	GLuint _program;
+	GLuint _vertexArray;
+	GLuint _arrayBuffer;
+	GLuint _activeUnit;
+	GLuint _textures[TEXTURE_UNITS][TARGET_COUNT];
+	GLuint _caps[CAP_COUNT];
+	GLuint _depthFunc;
+	GLuint _blendSource;
+	GLuint _blendDestination;
+
+	Counters _frame;
+	Counters _lastFrame;
+
+	GLState()
+	{
+		_frame.issued = _frame.skipped = 0;
+		_lastFrame = _frame;
+		Invalidate();
+	}
+	GLState(const GLState&) = delete;
+	GLState& operator=(const GLState&) = delete;
+
+	void issue() { _frame.issued++; }
+
+	//True when value differs from the shadow copy, which then takes it
+	bool filter(GLuint& current, GLuint value)
+	{
+		if (current == value)
+		{
+			_frame.skipped++;
+			return false;
+		}
+		current = value;
+		_frame.issued++;
+		return true;
+	}
+
+	static int targetSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_CUBE_MAP: return 1;
+		case GL_TEXTURE_2D_ARRAY: return 2;
+		default: return -1;
+		}
+	}
+
+	static int capSlot(GLenum cap)
+	{
+		switch (cap)
+		{
+		case GL_DEPTH_TEST: return 0;
+		case GL_BLEND: return 1;
+		case GL_CULL_FACE: return 2;
+		default: return -1;
+		}
+	}
+
+	void setCap(GLenum cap, bool enabled)
+	{
+		int slot = capSlot(cap);
+		if (slot >= 0 && !filter(_caps[slot], enabled ? 1 : 0))
+			return;
+		if (slot < 0)
+			issue();
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+};
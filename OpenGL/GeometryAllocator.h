@@ -0,0 +1,278 @@
+#pragma once
+#include "VertexFormat.h"
+#include "GLState.h"
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+
+//First-fit allocator over [0, capacity). Freed ranges are merged with their free neighbours.
+class RangeAllocator
+{
+public:
+	RangeAllocator() : _capacity(0), _used(0)
+	{
+	}
+
+	size_t GetCapacity() const { return _capacity; }
+	size_t GetUsed() const { return _used; }
+
+	//Returns false when no free range fits, Grow and try again
+	bool Allocate(size_t size, size_t alignment, size_t& offset)
+	{
+		for (std::map<size_t, size_t>::iterator it = _free.begin(); it != _free.end(); ++it)
+		{
+			size_t freeStart = it->first;
+			size_t freeEnd = it->first + it->second;
+			size_t start = (freeStart + alignment - 1) / alignment * alignment;
+			if (start + size > freeEnd)
+				continue;
+
+			_free.erase(it);
+			if (start > freeStart)
+				_free[freeStart] = start - freeStart;
+			if (start + size < freeEnd)
+				_free[start + size] = freeEnd - (start + size);
+			_used += size;
+			offset = start;
+			return true;
+		}
+		return false;
+	}
+
+	void Free(size_t offset, size_t size)
+	{
+		_used -= size;
+		std::map<size_t, size_t>::iterator next = _free.lower_bound(offset);
+		if (next != _free.begin())
+		{
+			std::map<size_t, size_t>::iterator previous = std::prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				offset = previous->first;
+				size += previous->second;
+				_free.erase(previous);
+			}
+		}
+		if (next != _free.end() && offset + size == next->first)
+		{
+			size += next->second;
+			_free.erase(next);
+		}
+		_free[offset] = size;
+	}
+
+	void Grow(size_t capacity)
+	{
+		if (capacity <= _capacity)
+			return;
+		size_t added = capacity - _capacity;
+		_used += added; //Free takes it back off
+		Free(_capacity, added);
+		_capacity = capacity;
+	}
+
+private:
+	std::map<size_t, size_t> _free; //Offset -> size
+	size_t _capacity;
+	size_t _used;
+};
+
+//Sub-allocates static mesh geometry out of one vertex buffer and one index buffer per
+//VertexFormat. Every mesh of a format draws through the same VAO with glDrawElementsBaseVertex,
+//so switching between meshes no longer changes vertex array or buffer bindings.
+class GeometryAllocator
+{
+public:
+	struct Allocation
+	{
+		VertexFormat format = VertexFormat::Full;
+		unsigned int baseVertex = 0;
+		unsigned int vertexCount = 0;
+		size_t indexOffset = 0; //Bytes into the index buffer
+		size_t indexBytes = 0;
+	};
+
+	static GeometryAllocator& Get()
+	{
+		static GeometryAllocator allocator;
+		return allocator;
+	}
+
+	//GL thread: copies vertexCount vertices laid out for format, and indexBytes of indices, into
+	//the shared buffers. Index ranges are 4 byte aligned so 16 and 32-bit indices can share them.
+	Allocation Allocate(VertexFormat format, const void* vertexData, unsigned int vertexCount, const void* indexData, size_t indexBytes)
+	{
+		Pool& pool = getPool(format);
+		Allocation allocation;
+		allocation.format = format;
+		allocation.vertexCount = vertexCount;
+		allocation.indexBytes = indexBytes;
+
+		size_t stride = VertexStride(format);
+		if (vertexCount > 0)
+		{
+			size_t offset = 0;
+			while (!pool.vertices.Allocate(vertexCount, 1, offset))
+				grow(pool, vertexCount, 0);
+			allocation.baseVertex = (unsigned int)offset;
+
+			glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, offset * stride, vertexCount * stride, vertexData);
+		}
+		if (indexBytes > 0)
+		{
+			while (!pool.indices.Allocate(indexBytes, sizeof(unsigned int), allocation.indexOffset))
+				grow(pool, 0, indexBytes);
+
+			glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexBytes, indexData);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return allocation;
+	}
+
+	void Free(const Allocation& allocation)
+	{
+		Pool& pool = _pools[(int)allocation.format];
+		if (allocation.vertexCount > 0)
+			pool.vertices.Free(allocation.baseVertex, allocation.vertexCount);
+		if (allocation.indexBytes > 0)
+			pool.indices.Free(allocation.indexOffset, allocation.indexBytes);
+	}
+
+	//VAO over format's buffers used by every Mesh of that format
+	unsigned int GetVertexArray(VertexFormat format)
+	{
+		return getPool(format).vertexArrays[0];
+	}
+
+	//Extra VAO over format's buffers for callers adding their own attributes (e.g. per instance
+	//data). It is kept pointing at the buffers when they grow.
+	unsigned int CreateVertexArray(VertexFormat format)
+	{
+		Pool& pool = getPool(format);
+		unsigned int vertexArray = 0;
+		glGenVertexArrays(1, &vertexArray);
+		bindBuffers(pool, vertexArray);
+		pool.vertexArrays.push_back(vertexArray);
+		return vertexArray;
+	}
+
+	void PrintStats() const
+	{
+		for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+		{
+			const Pool& pool = _pools[i];
+			if (pool.VBO == 0)
+				continue;
+			size_t stride = VertexStride(pool.format);
+			std::cout << "Geometry buffer (" << (pool.format == VertexFormat::Packed ? "packed" : "full") << "): "
+				<< pool.vertices.GetUsed() * stride / 1024 << "/" << pool.vertices.GetCapacity() * stride / 1024 << " KB vertices, "
+				<< pool.indices.GetUsed() / 1024 << "/" << pool.indices.GetCapacity() / 1024 << " KB indices" << std::endl;
+		}
+	}
+
+private:
+	static const size_t INITIAL_VERTICES = 64 * 1024;
+	static const size_t INITIAL_INDEX_BYTES = 1024 * 1024;
+
+	struct Pool
+	{
+		VertexFormat format = VertexFormat::Full;
+		unsigned int VBO = 0;
+		unsigned int EBO = 0;
+		std::vector<unsigned int> vertexArrays;
+		RangeAllocator vertices; //In vertices
+		RangeAllocator indices; //In bytes
+	};
+
+	Pool _pools[VERTEX_FORMAT_COUNT];
+
+	GeometryAllocator()
+	{
+		for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+			_pools[i].format = (VertexFormat)i;
+	}
+
+	//The buffers belong to the GL context, which is already gone when statics are destroyed
+	~GeometryAllocator()
+	{
+	}
+
+	GeometryAllocator(const GeometryAllocator&) = delete;
+	GeometryAllocator& operator=(const GeometryAllocator&) = delete;
+
+	//Buffers are created on first use, on the GL thread
+	Pool& getPool(VertexFormat format)
+	{
+		Pool& pool = _pools[(int)format];
+		if (pool.VBO != 0)
+			return pool;
+
+		glGenBuffers(1, &pool.VBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_VERTICES * VertexStride(format), nullptr, GL_STATIC_DRAW);
+		glGenBuffers(1, &pool.EBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_INDEX_BYTES, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		pool.vertices.Grow(INITIAL_VERTICES);
+		pool.indices.Grow(INITIAL_INDEX_BYTES);
+
+		unsigned int vertexArray = 0;
+		glGenVertexArrays(1, &vertexArray);
+		bindBuffers(pool, vertexArray);
+		pool.vertexArrays.push_back(vertexArray);
+		return pool;
+	}
+
+	static void bindBuffers(const Pool& pool, unsigned int vertexArray)
+	{
+		GLState::Get().BindVertexArray(vertexArray);
+		GLState::Get().BindArrayBuffer(pool.VBO);
+		SetVertexAttributes(pool.format);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+		GLState::Get().BindVertexArray(0);
+		GLState::Get().BindArrayBuffer(0);
+	}
+
+	//At least doubles whichever buffer is short of space, keeping its contents
+	void grow(Pool& pool, size_t vertexCount, size_t indexBytes)
+	{
+		size_t stride = VertexStride(pool.format);
+		if (vertexCount > 0)
+		{
+			size_t capacity = pool.vertices.GetCapacity();
+			size_t grown = std::max(capacity * 2, capacity + vertexCount);
+			pool.VBO = growBuffer(pool.VBO, capacity * stride, grown * stride);
+			pool.vertices.Grow(grown);
+		}
+		if (indexBytes > 0)
+		{
+			size_t capacity = pool.indices.GetCapacity();
+			size_t grown = std::max(capacity * 2, capacity + indexBytes);
+			pool.EBO = growBuffer(pool.EBO, capacity, grown);
+			pool.indices.Grow(grown);
+		}
+
+		for (unsigned int i = 0; i < pool.vertexArrays.size(); i++)
+			bindBuffers(pool, pool.vertexArrays[i]);
+	}
+
+	static unsigned int growBuffer(unsigned int buffer, size_t size, size_t grownSize)
+	{
+		unsigned int grown = 0;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, grownSize, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		GLState::Get().DeleteBuffer(buffer);
+		return grown;
+	}
+};
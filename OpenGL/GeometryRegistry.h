@@ -0,0 +1,83 @@
+#pragma once
+#include "Mesh.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <iostream>
+
+//Geometry of one source file. Materials are only referenced by name so every Model
+//sharing it can bind its own texture set.
+struct ModelGeometry
+{
+	std::vector<std::shared_ptr<MeshGeometry>> meshes;
+	std::vector<std::string> materials; //Material name per mesh
+	std::vector<std::string> materialLibraries; //"mtllib" entries, relative to each model's directory
+};
+
+//Process-wide registry of loaded geometry keyed by source content hash.
+//Entries are weak so geometry is freed once the last Model using it is destroyed.
+//Thread safe, import workers check it to skip parsing geometry that is already loaded.
+class GeometryRegistry
+{
+public:
+	static GeometryRegistry& Get()
+	{
+		static GeometryRegistry registry;
+		return registry;
+	}
+
+	std::shared_ptr<ModelGeometry> Find(uint64_t contentHash)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry>>::iterator it = _entries.find(contentHash);
+		if (it != _entries.end())
+		{
+			std::shared_ptr<ModelGeometry> geometry = it->second.lock();
+			if (geometry)
+			{
+				_hits++;
+				return geometry;
+			}
+			_entries.erase(it);
+		}
+		_misses++;
+		return nullptr;
+	}
+
+	bool Contains(uint64_t contentHash) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry>>::const_iterator it = _entries.find(contentHash);
+		return it != _entries.end() && !it->second.expired();
+	}
+
+	void Add(uint64_t contentHash, const std::shared_ptr<ModelGeometry>& geometry)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_entries[contentHash] = geometry;
+	}
+
+	void PrintStats() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		unsigned int live = 0;
+		for (std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry>>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+		{
+			if (!it->second.expired())
+				live++;
+		}
+		std::cout << "Geometry registry: " << live << " unique, " << _hits << " shared, " << _misses << " loaded" << std::endl;
+	}
+
+private:
+	GeometryRegistry() : _hits(0), _misses(0) {}
+
+	std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry>> _entries;
+	mutable std::mutex _mutex;
+	unsigned int _hits;
+	unsigned int _misses;
+};
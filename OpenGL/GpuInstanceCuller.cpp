@@ -0,0 +1,223 @@
+#include "GpuInstanceCuller.h"
+#include "GLState.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+namespace
+{
+	const char* CULL_VERTEX_PATH = "Shaders/AsteroidCull.vs";
+	const char* CULL_GEOMETRY_PATH = "Shaders/AsteroidCull.gs";
+
+	bool HasExtension(const char* name)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (extension && std::strcmp(extension, name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool ReadSource(const char* path, std::string& source)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "ERROR::GPU_INSTANCE_CULLER::Can't read " << path << std::endl;
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		source = stream.str();
+		return true;
+	}
+
+	GLuint CompileStage(GLenum type, const std::string& source, const char* path)
+	{
+		GLuint shader = glCreateShader(type);
+		const char* code = source.c_str();
+		glShaderSource(shader, 1, &code, NULL);
+		glCompileShader(shader);
+		int success;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, 512, NULL, infoLog);
+			std::cout << "Compilation failed (" << path << ")" << infoLog << std::endl;
+		}
+		return shader;
+	}
+}
+
+GpuInstanceCuller::GpuInstanceCuller(GLADloadproc loader, const glm::vec4* spheres, const void* instances, unsigned int count)
+	: _supported(false), _count(count), _visible(0), _queryPending(false), _drawElementsIndirect(nullptr), _program(0),
+	_planesLocation(-1), _viewPosLocation(-1), _maxDistanceLocation(-1), _input(0), _inputVAO(0), _output(0), _indirect(0), _query(0)
+{
+	bool indirect = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 0) || HasExtension("GL_ARB_draw_indirect");
+	bool queryBuffer = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) || HasExtension("GL_ARB_query_buffer_object");
+	if (indirect)
+		_drawElementsIndirect = (DrawElementsIndirectProc)loader("glDrawElementsIndirect");
+	if (!_drawElementsIndirect || !queryBuffer)
+	{
+		std::cout << "GPU instance culling needs indirect draws and query buffers (GL 4.4), culling on the CPU" << std::endl;
+		return;
+	}
+	if (!buildProgram())
+		return;
+
+	std::vector<CullInstance> input(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		input[i].sphere = spheres[i];
+		std::memcpy(input[i].instance, (const unsigned char*)instances + (size_t)i * INSTANCE_BYTES, INSTANCE_BYTES);
+	}
+	glGenBuffers(1, &_input);
+	GLState::Get().BindArrayBuffer(_input);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(CullInstance), input.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &_inputVAO);
+	GLState::Get().BindVertexArray(_inputVAO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(CullInstance), (void*)offsetof(CullInstance, sphere));
+	glEnableVertexAttribArray(1);
+	glVertexAttribIPointer(1, 4, GL_UNSIGNED_INT, sizeof(CullInstance), (void*)offsetof(CullInstance, instance));
+	GLState::Get().BindVertexArray(0);
+
+	glGenBuffers(1, &_output);
+	GLState::Get().BindArrayBuffer(_output);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)count * INSTANCE_BYTES, NULL, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &_indirect);
+	glGenQueries(1, &_query);
+	_supported = true;
+}
+
+GpuInstanceCuller::~GpuInstanceCuller()
+{
+	if (_query)
+		glDeleteQueries(1, &_query);
+	if (_indirect)
+		GLState::Get().DeleteBuffer(_indirect);
+	if (_output)
+		GLState::Get().DeleteBuffer(_output);
+	if (_inputVAO)
+	{
+		GLState::Get().BindVertexArray(0);
+		glDeleteVertexArrays(1, &_inputVAO);
+	}
+	if (_input)
+		GLState::Get().DeleteBuffer(_input);
+	if (_program)
+	{
+		GLState::Get().UseProgram(0);
+		glDeleteProgram(_program);
+	}
+}
+
+unsigned int GpuInstanceCuller::AddCommand(GLenum indexType, unsigned int indexCount, GLuint firstIndex, GLint baseVertex)
+{
+	DrawCommand command = { indexCount, 0, firstIndex, baseVertex, 0 };
+	_commands.push_back(command);
+	_indexTypes.push_back(indexType);
+	if (_supported)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, _commands.size() * sizeof(DrawCommand), _commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	return (unsigned int)_commands.size() - 1;
+}
+
+void GpuInstanceCuller::Cull(const Frustum& frustum, const glm::vec3& viewPos, float maxDistance)
+{
+	if (!_supported || _count == 0)
+		return;
+
+	//Last frame's count, only if it's already there
+	if (_queryPending)
+	{
+		GLuint available = 0;
+		glGetQueryObjectuiv(_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+			glGetQueryObjectuiv(_query, GL_QUERY_RESULT, &_visible);
+	}
+
+	glm::vec4 planes[6];
+	for (int i = 0; i < 6; i++)
+		planes[i] = frustum.GetPlane(i);
+	GLState::Get().UseProgram(_program);
+	glUniform4fv(_planesLocation, 6, &planes[0].x);
+	glUniform3fv(_viewPosLocation, 1, &viewPos.x);
+	glUniform1f(_maxDistanceLocation, maxDistance);
+
+	GLState::Get().BindVertexArray(_inputVAO);
+	GLState::Get().Enable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, _output);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, _query);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, (GLsizei)_count);
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	GLState::Get().Disable(GL_RASTERIZER_DISCARD);
+	_queryPending = true;
+
+	//The GPU writes the count into every command once the pass is done, the CPU doesn't wait
+	glBindBuffer(GL_QUERY_BUFFER, _indirect);
+	for (unsigned int i = 0; i < _commands.size(); i++)
+		glGetQueryObjectuiv(_query, GL_QUERY_RESULT, (GLuint*)(i * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount)));
+	glBindBuffer(GL_QUERY_BUFFER, 0);
+}
+
+void GpuInstanceCuller::Draw(unsigned int command) const
+{
+	if (!_supported || command >= _commands.size())
+		return;
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect);
+	_drawElementsIndirect(GL_TRIANGLES, _indexTypes[command], (const void*)(command * sizeof(DrawCommand)));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool GpuInstanceCuller::buildProgram()
+{
+	std::string vertexSource, geometrySource;
+	if (!ReadSource(CULL_VERTEX_PATH, vertexSource) || !ReadSource(CULL_GEOMETRY_PATH, geometrySource))
+		return false;
+
+	GLuint vertex = CompileStage(GL_VERTEX_SHADER, vertexSource, CULL_VERTEX_PATH);
+	GLuint geometry = CompileStage(GL_GEOMETRY_SHADER, geometrySource, CULL_GEOMETRY_PATH);
+	_program = glCreateProgram();
+	glAttachShader(_program, vertex);
+	glAttachShader(_program, geometry);
+
+	//Must be set before linking
+	const char* varyings[] = { "instanceData" };
+	glTransformFeedbackVaryings(_program, 1, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(_program);
+	glDeleteShader(vertex);
+	glDeleteShader(geometry);
+
+	int success;
+	glGetProgramiv(_program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		char infoLog[512];
+		glGetProgramInfoLog(_program, 512, NULL, infoLog);
+		std::cout << "Linking failed (" << CULL_VERTEX_PATH << ")" << infoLog << std::endl;
+		glDeleteProgram(_program);
+		_program = 0;
+		return false;
+	}
+	_planesLocation = glGetUniformLocation(_program, "planes");
+	_viewPosLocation = glGetUniformLocation(_program, "viewPos");
+	_maxDistanceLocation = glGetUniformLocation(_program, "maxDistance");
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+#include "Frustum.h"
+
+#include <vector>
+
+//GL 4.0 / ARB_draw_indirect and GL 4.4 / ARB_query_buffer_object, not in the GL 3.3 loader
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_QUERY_BUFFER
+#define GL_QUERY_BUFFER 0x9192
+#endif
+
+//Frustum and distance culling of static instances on the GPU, the alternative to InstanceCuller
+//when the instance count outgrows the CPU. Each frame one point per instance goes through
+//Shaders/AsteroidCull.vs (the test) and .gs (drops the rejected ones) with the rasterizer off,
+//and transform feedback writes the instance data of the survivors to the front of GetBuffer. The
+//GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query is copied by the GPU into the instance count of
+//indirect draw commands, so the CPU never waits for or even sees the count.
+class GpuInstanceCuller
+{
+public:
+	//Instances are passed through as 16 bytes (a uvec4 in the cull pass)
+	static const unsigned int INSTANCE_BYTES = 16;
+
+	//GL thread, after glad. Instance i is INSTANCE_BYTES at instances + i * INSTANCE_BYTES,
+	//bounded by spheres[i] (xyz center, w radius) in the space of the frustums passed to Cull.
+	//Check IsSupported: without indirect draws and query buffers nothing is created.
+	GpuInstanceCuller(GLADloadproc loader, const glm::vec4* spheres, const void* instances, unsigned int count);
+	~GpuInstanceCuller();
+
+	GpuInstanceCuller(const GpuInstanceCuller&) = delete;
+	GpuInstanceCuller& operator=(const GpuInstanceCuller&) = delete;
+
+	bool IsSupported() const { return _supported; }
+
+	//Buffer of visible instances, for the instance attributes of the VAO
+	GLuint GetBuffer() const { return _output; }
+
+	//Adds a draw of indexCount indices of the bound VAO's element buffer with the culled instances.
+	//Returns the command for Draw.
+	unsigned int AddCommand(GLenum indexType, unsigned int indexCount, GLuint firstIndex, GLint baseVertex);
+
+	//GL thread, once a frame: culls against frustum and drops instances whose sphere is further
+	//than maxDistance from viewPos, both in the space of the spheres
+	void Cull(const Frustum& frustum, const glm::vec3& viewPos, float maxDistance);
+
+	//Draws command with the current program and VAO, as many instances as Cull kept
+	void Draw(unsigned int command) const;
+
+	//Count kept by an earlier Cull, read once the GPU has it. For display only, it lags a frame or two.
+	unsigned int GetVisibleCount() const { return _visible; }
+	unsigned int GetInstanceCount() const { return _count; }
+
+private:
+	//Layout glDrawElementsIndirect reads
+	struct DrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	//Per instance input of the cull pass
+	struct CullInstance
+	{
+		glm::vec4 sphere;
+		unsigned char instance[INSTANCE_BYTES];
+	};
+
+	typedef void (APIENTRYP DrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect);
+
+	bool _supported;
+	unsigned int _count;
+	unsigned int _visible;
+	bool _queryPending;
+	DrawElementsIndirectProc _drawElementsIndirect;
+
+	GLuint _program;
+	GLint _planesLocation, _viewPosLocation, _maxDistanceLocation;
+	GLuint _input, _inputVAO;
+	GLuint _output;
+	GLuint _indirect;
+	GLuint _query;
+	std::vector<DrawCommand> _commands;
+	std::vector<GLenum> _indexTypes;
+
+	bool buildProgram();
+};
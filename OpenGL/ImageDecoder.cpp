@@ -0,0 +1,251 @@
+#include "ImageDecoder.h"
+#include "stb_image.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMAGE_DECODER_SSE
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSSE3_TARGET
+#else
+#include <cpuid.h>
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace
+{
+	//Half the hardware threads, the asset ThreadPool and the render thread share the rest
+	unsigned int DecodeThreadCount()
+	{
+		unsigned int hardware = std::thread::hardware_concurrency();
+		return hardware > 4 ? hardware / 2 : 2;
+	}
+
+#ifdef IMAGE_DECODER_SSE
+	bool HasSSSE3()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 9)) != 0;
+#endif
+	}
+
+	const bool SSSE3 = HasSSSE3();
+
+	//RGB -> RGBA, 4 pixels per shuffle. Returns the pixels converted.
+	SSSE3_TARGET int ExpandRGB(const unsigned char* in, unsigned char* out, int width)
+	{
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		int x = 0;
+		//The 16 byte load reads 4 bytes past the 4 pixels, stop while a whole pixel is left over
+		for (; x + 6 <= width; x += 4)
+		{
+			__m128i rgb = _mm_loadu_si128((const __m128i*)(in + x * 3));
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+		}
+		return x;
+	}
+
+	//Grey -> RGBA, 16 pixels at a time with SSE2 unpacks
+	int ExpandGrey(const unsigned char* in, unsigned char* out, int width)
+	{
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		int x = 0;
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i grey = _mm_loadu_si128((const __m128i*)(in + x));
+			__m128i low = _mm_unpacklo_epi8(grey, grey);
+			__m128i high = _mm_unpackhi_epi8(grey, grey);
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_or_si128(_mm_unpacklo_epi16(low, low), alpha));
+			_mm_storeu_si128((__m128i*)(out + x * 4 + 16), _mm_or_si128(_mm_unpackhi_epi16(low, low), alpha));
+			_mm_storeu_si128((__m128i*)(out + x * 4 + 32), _mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+			_mm_storeu_si128((__m128i*)(out + x * 4 + 48), _mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+		}
+		return x;
+	}
+#endif
+
+	void ConvertRow(const unsigned char* in, int inChannels, unsigned char* out, int outChannels, int width)
+	{
+		if (inChannels == outChannels)
+		{
+			std::memcpy(out, in, (size_t)width * inChannels);
+			return;
+		}
+
+		int x = 0;
+#ifdef IMAGE_DECODER_SSE
+		if (inChannels == 3 && SSSE3)
+			x = ExpandRGB(in, out, width);
+		else if (inChannels == 1)
+			x = ExpandGrey(in, out, width);
+#endif
+		for (; x < width; x++)
+		{
+			const unsigned char* source = in + x * inChannels;
+			unsigned char* target = out + x * 4;
+			if (inChannels <= 2)
+			{
+				target[0] = target[1] = target[2] = source[0];
+				target[3] = inChannels == 2 ? source[1] : 255;
+			}
+			else
+			{
+				target[0] = source[0];
+				target[1] = source[1];
+				target[2] = source[2];
+				target[3] = inChannels == 4 ? source[3] : 255;
+			}
+		}
+	}
+}
+
+DecodedImage::DecodedImage(DecodedImage&& other) : pixels(other.pixels), width(other.width), height(other.height), channels(other.channels), _fromStb(other._fromStb)
+{
+	other.pixels = nullptr;
+}
+
+DecodedImage& DecodedImage::operator=(DecodedImage&& other)
+{
+	if (this != &other)
+	{
+		Free();
+		pixels = other.pixels;
+		width = other.width;
+		height = other.height;
+		channels = other.channels;
+		_fromStb = other._fromStb;
+		other.pixels = nullptr;
+	}
+	return *this;
+}
+
+void DecodedImage::Free()
+{
+	if (_fromStb)
+		stbi_image_free(pixels);
+	else
+		std::free(pixels);
+	pixels = nullptr;
+}
+
+ImageDecoder& ImageDecoder::Get()
+{
+	static ImageDecoder decoder;
+	return decoder;
+}
+
+ImageDecoder::ImageDecoder() : _pool(DecodeThreadCount())
+{
+}
+
+bool ImageDecoder::Decode(const std::string& path, const DecodeOptions& options, DecodedImage& image)
+{
+	image.Free();
+
+	//Always top down from stb, flipping happens in the conversion pass
+	stbi_set_flip_vertically_on_load_thread(0);
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+	if (!pixels)
+		return false;
+
+	image.width = width;
+	image.height = height;
+	if (options.channels == 0 || options.channels == channels)
+	{
+		if (options.flip)
+			FlipRows(pixels, (size_t)width * channels, height);
+		image.pixels = pixels;
+		image.channels = channels;
+		image._fromStb = true;
+		return true;
+	}
+
+	unsigned char* converted = (unsigned char*)std::malloc((size_t)width * height * 4);
+	if (!converted)
+	{
+		stbi_image_free(pixels);
+		return false;
+	}
+	ConvertRows(pixels, channels, converted, 4, width, height, options.flip);
+	stbi_image_free(pixels);
+	image.pixels = converted;
+	image.channels = 4;
+	image._fromStb = false;
+	return true;
+}
+
+std::vector<DecodedImage> ImageDecoder::DecodeAll(const std::vector<std::string>& paths, const DecodeOptions& options)
+{
+	std::vector<DecodedImage> images(paths.size());
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t remaining = paths.size();
+
+	for (unsigned int i = 0; i < paths.size(); i++)
+	{
+		_pool.Submit([&, i]
+		{
+			if (!Decode(paths[i], options, images[i]))
+				std::cout << "Failed to decode image: " << paths[i] << std::endl;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--remaining == 0)
+				finished.notify_one();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&] { return remaining == 0; });
+	return images;
+}
+
+void ImageDecoder::ConvertRows(const unsigned char* in, int inChannels, unsigned char* out, int outChannels, int width, int height, bool flip)
+{
+	size_t inRow = (size_t)width * inChannels;
+	size_t outRow = (size_t)width * outChannels;
+	for (int y = 0; y < height; y++)
+	{
+		int source = flip ? height - 1 - y : y;
+		ConvertRow(in + source * inRow, inChannels, out + y * outRow, outChannels, width);
+	}
+}
+
+void ImageDecoder::FlipRows(unsigned char* pixels, size_t rowBytes, int height)
+{
+	for (int y = 0; y < height / 2; y++)
+	{
+		unsigned char* top = pixels + y * rowBytes;
+		unsigned char* bottom = pixels + (height - 1 - y) * rowBytes;
+		size_t x = 0;
+#ifdef IMAGE_DECODER_SSE
+		for (; x + 16 <= rowBytes; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(top + x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(bottom + x));
+			_mm_storeu_si128((__m128i*)(top + x), b);
+			_mm_storeu_si128((__m128i*)(bottom + x), a);
+		}
+#endif
+		for (; x < rowBytes; x++)
+		{
+			unsigned char swap = top[x];
+			top[x] = bottom[x];
+			bottom[x] = swap;
+		}
+	}
+}
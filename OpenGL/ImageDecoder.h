@@ -0,0 +1,69 @@
+#pragma once
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+//Per request decode options, stb_image's global flip flag is never touched
+struct DecodeOptions
+{
+	bool flip = false;	//First row is the bottom of the image, as GL expects
+	int channels = 0;	//0 keeps the file's channel count, 4 expands to RGBA
+};
+
+//Decoded 8 bit image, move only
+class DecodedImage
+{
+public:
+	DecodedImage() : pixels(nullptr), width(0), height(0), channels(0), _fromStb(false)
+	{
+	}
+	~DecodedImage() { Free(); }
+
+	DecodedImage(DecodedImage&& other);
+	DecodedImage& operator=(DecodedImage&& other);
+	DecodedImage(const DecodedImage&) = delete;
+	DecodedImage& operator=(const DecodedImage&) = delete;
+
+	void Free();
+
+	unsigned char* pixels;
+	int width, height, channels;
+
+private:
+	friend class ImageDecoder;
+	bool _fromStb; //Else malloc'd by a conversion
+};
+
+//Image decoding on a dedicated worker pool, so texture work does not queue behind mesh imports.
+//Files are decoded by stb_image (SSE2 IDCT and colour conversion for JPEG), then flipped and
+//expanded to the requested channel count in one SSE pass.
+class ImageDecoder
+{
+public:
+	static ImageDecoder& Get();
+
+	//Any thread: decodes path on the calling thread
+	static bool Decode(const std::string& path, const DecodeOptions& options, DecodedImage& image);
+
+	//Decodes every path in parallel and waits for them. Not from a decode worker.
+	std::vector<DecodedImage> DecodeAll(const std::vector<std::string>& paths, const DecodeOptions& options);
+
+	//Runs an image task (decode, compress, cook) on a decode worker
+	void Submit(std::function<void()> task) { _pool.Submit(std::move(task)); }
+
+	unsigned int GetThreadCount() const { return _pool.GetThreadCount(); }
+
+	//Writes height rows of width pixels as outChannels (4, or the same as inChannels), bottom up when flip
+	static void ConvertRows(const unsigned char* in, int inChannels, unsigned char* out, int outChannels, int width, int height, bool flip);
+	//In place vertical flip
+	static void FlipRows(unsigned char* pixels, size_t rowBytes, int height);
+
+private:
+	ImageDecoder();
+	ImageDecoder(const ImageDecoder&) = delete;
+	ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+	ThreadPool _pool;
+};
@@ -0,0 +1,294 @@
+#include "InstanceCuller.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define INSTANCE_CULLER_SSE
+#include <xmmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_TARGET
+#else
+#define AVX_TARGET __attribute__((target("avx")))
+#endif
+#endif
+
+namespace
+{
+	//A few workers are plenty, a chunk is a few microseconds of work
+	unsigned int CullThreadCount()
+	{
+		unsigned int hardware = std::thread::hardware_concurrency();
+		return std::max(1u, std::min(hardware > 1 ? hardware - 1 : 1, 3u));
+	}
+
+#ifdef INSTANCE_CULLER_SSE
+	bool HasAVX()
+	{
+#ifdef _MSC_VER
+		//AVX, and the OS saving the YMM registers
+		int info[4];
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0)
+			return false;
+		return (_xgetbv(0) & 6) == 6;
+#else
+		return __builtin_cpu_supports("avx") != 0;
+#endif
+	}
+
+	const bool AVX = HasAVX();
+
+	unsigned int CountTrailingZeros(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	//Copies the instances of the lanes set in mask, base being the first lane's instance
+	unsigned int Compact(unsigned int mask, unsigned int base, const unsigned char* instances, unsigned int stride, unsigned char* out)
+	{
+		unsigned int written = 0;
+		while (mask)
+		{
+			std::memcpy(out + written++ * stride, instances + (base + CountTrailingZeros(mask)) * stride, stride);
+			mask &= mask - 1;
+		}
+		return written;
+	}
+
+	//Lanes below remaining, for the last group of a chunk
+	unsigned int LaneMask(unsigned int lanes, unsigned int remaining)
+	{
+		return remaining >= lanes ? (1u << lanes) - 1 : (1u << remaining) - 1;
+	}
+
+	//8 spheres a test. A sphere is visible when it is not entirely behind any plane and some of it
+	//is within maxDistance of viewPos, compared squared: |center - viewPos| <= maxDistance + radius
+	AVX_TARGET unsigned int CullAVX(const float* x, const float* y, const float* z, const float* radius, unsigned int count,
+		const glm::vec4* planes, const glm::vec3& viewPos, float maxDistance, const unsigned char* instances, unsigned int stride, unsigned char* out)
+	{
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm256_set1_ps(planes[p].x);
+			planeY[p] = _mm256_set1_ps(planes[p].y);
+			planeZ[p] = _mm256_set1_ps(planes[p].z);
+			planeW[p] = _mm256_set1_ps(planes[p].w);
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 viewX = _mm256_set1_ps(viewPos.x), viewY = _mm256_set1_ps(viewPos.y), viewZ = _mm256_set1_ps(viewPos.z);
+		const __m256 range = _mm256_set1_ps(maxDistance);
+
+		unsigned int visible = 0;
+		for (unsigned int i = 0; i < count; i += 8)
+		{
+			__m256 cx = _mm256_loadu_ps(x + i);
+			__m256 cy = _mm256_loadu_ps(y + i);
+			__m256 cz = _mm256_loadu_ps(z + i);
+			__m256 r = _mm256_loadu_ps(radius + i);
+			__m256 negativeRadius = _mm256_sub_ps(zero, r);
+			__m256 dx = _mm256_sub_ps(cx, viewX), dy = _mm256_sub_ps(cy, viewY), dz = _mm256_sub_ps(cz, viewZ);
+			__m256 reach = _mm256_add_ps(range, r);
+			__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)),
+				_mm256_mul_ps(reach, reach), _CMP_LE_OQ);
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy)),
+					_mm256_add_ps(_mm256_mul_ps(planeZ[p], cz), planeW[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+			unsigned int mask = (unsigned int)_mm256_movemask_ps(inside) & LaneMask(8, count - i);
+			visible += Compact(mask, i, instances, stride, out + visible * stride);
+		}
+		return visible;
+	}
+
+	//As CullAVX, 4 spheres a test
+	unsigned int CullSSE(const float* x, const float* y, const float* z, const float* radius, unsigned int count,
+		const glm::vec4* planes, const glm::vec3& viewPos, float maxDistance, const unsigned char* instances, unsigned int stride, unsigned char* out)
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(planes[p].x);
+			planeY[p] = _mm_set1_ps(planes[p].y);
+			planeZ[p] = _mm_set1_ps(planes[p].z);
+			planeW[p] = _mm_set1_ps(planes[p].w);
+		}
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 viewX = _mm_set1_ps(viewPos.x), viewY = _mm_set1_ps(viewPos.y), viewZ = _mm_set1_ps(viewPos.z);
+		const __m128 range = _mm_set1_ps(maxDistance);
+
+		unsigned int visible = 0;
+		for (unsigned int i = 0; i < count; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(x + i);
+			__m128 cy = _mm_loadu_ps(y + i);
+			__m128 cz = _mm_loadu_ps(z + i);
+			__m128 r = _mm_loadu_ps(radius + i);
+			__m128 negativeRadius = _mm_sub_ps(zero, r);
+			__m128 dx = _mm_sub_ps(cx, viewX), dy = _mm_sub_ps(cy, viewY), dz = _mm_sub_ps(cz, viewZ);
+			__m128 reach = _mm_add_ps(range, r);
+			__m128 inside = _mm_cmple_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)),
+				_mm_mul_ps(reach, reach));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+					_mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+			unsigned int mask = (unsigned int)_mm_movemask_ps(inside) & LaneMask(4, count - i);
+			visible += Compact(mask, i, instances, stride, out + visible * stride);
+		}
+		return visible;
+	}
+#else
+	unsigned int CullScalar(const float* x, const float* y, const float* z, const float* radius, unsigned int count,
+		const glm::vec4* planes, const glm::vec3& viewPos, float maxDistance, const unsigned char* instances, unsigned int stride, unsigned char* out)
+	{
+		unsigned int visible = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 offset = glm::vec3(x[i], y[i], z[i]) - viewPos;
+			float reach = maxDistance + radius[i];
+			bool inside = glm::dot(offset, offset) <= reach * reach;
+			for (int p = 0; p < 6 && inside; p++)
+				inside = planes[p].x * x[i] + planes[p].y * y[i] + planes[p].z * z[i] + planes[p].w >= -radius[i];
+			if (inside)
+				std::memcpy(out + visible++ * stride, instances + i * stride, stride);
+		}
+		return visible;
+	}
+#endif
+}
+
+InstanceCuller::InstanceCuller(const glm::vec4* spheres, const void* instances, unsigned int count, unsigned int stride)
+	: _count(count), _stride(stride), _buffer(0), _visible(0), _maxDistance(0.0f), _nextChunk(0), _pendingHelpers(0), _pool(CullThreadCount())
+{
+	size_t padded = (count + 7) & ~7u;
+	_x.assign(padded, 0.0f);
+	_y.assign(padded, 0.0f);
+	_z.assign(padded, 0.0f);
+	_radius.assign(padded, 0.0f);
+	_instances.assign((const unsigned char*)instances, (const unsigned char*)instances + (size_t)count * stride);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		_x[i] = spheres[i].x;
+		_y[i] = spheres[i].y;
+		_z[i] = spheres[i].z;
+		_radius[i] = spheres[i].w;
+	}
+	_staging.resize((size_t)count * stride);
+	_chunkVisible.resize(getChunkCount());
+	for (int i = 0; i < 6; i++)
+		_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	_viewPos = glm::vec3(0.0f);
+
+	//Orphaned and refilled every frame
+	glGenBuffers(1, &_buffer);
+	GLState::Get().BindArrayBuffer(_buffer);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)count * stride, NULL, GL_STREAM_DRAW);
+}
+
+InstanceCuller::~InstanceCuller()
+{
+	if (_buffer)
+		GLState::Get().DeleteBuffer(_buffer);
+}
+
+unsigned int InstanceCuller::Cull(const Frustum& frustum, const glm::vec3& viewPos, float maxDistance)
+{
+	_visible = 0;
+	unsigned int chunkCount = getChunkCount();
+	if (chunkCount == 0)
+		return 0;
+
+	for (int i = 0; i < 6; i++)
+		_planes[i] = frustum.GetPlane(i);
+	_viewPos = viewPos;
+	_maxDistance = maxDistance;
+	_nextChunk = 0;
+
+	//Workers help with the chunks the calling thread hasn't reached yet
+	unsigned int helpers = std::min(_pool.GetThreadCount(), chunkCount - 1);
+	_pendingHelpers = helpers;
+	for (unsigned int i = 0; i < helpers; i++)
+	{
+		_pool.Submit([this]
+		{
+			cullChunks();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_pendingHelpers--;
+			}
+			_helpersDone.notify_one();
+		});
+	}
+	cullChunks();
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_helpersDone.wait(lock, [this] { return _pendingHelpers == 0; });
+	}
+
+	for (unsigned int chunk = 0; chunk < chunkCount; chunk++)
+		_visible += _chunkVisible[chunk];
+	if (_visible == 0)
+		return 0;
+
+	//Invalidating lets the driver hand out fresh memory while last frame's draw still reads the old
+	GLState::Get().BindArrayBuffer(_buffer);
+	unsigned char* out = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (size_t)_visible * _stride, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!out)
+	{
+		std::cout << "ERROR::INSTANCE_CULLER::Failed to map the instance buffer" << std::endl;
+		_visible = 0;
+		return 0;
+	}
+	for (unsigned int chunk = 0; chunk < chunkCount; chunk++)
+	{
+		std::memcpy(out, &_staging[(size_t)chunk * CHUNK_INSTANCES * _stride], (size_t)_chunkVisible[chunk] * _stride);
+		out += (size_t)_chunkVisible[chunk] * _stride;
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	return _visible;
+}
+
+void InstanceCuller::cullChunks()
+{
+	unsigned int chunkCount = getChunkCount();
+	for (unsigned int chunk = _nextChunk++; chunk < chunkCount; chunk = _nextChunk++)
+		cullChunk(chunk);
+}
+
+void InstanceCuller::cullChunk(unsigned int chunk)
+{
+	unsigned int first = chunk * CHUNK_INSTANCES;
+	unsigned int count = _count - first;
+	if (count > CHUNK_INSTANCES)
+		count = CHUNK_INSTANCES;
+	const float* x = &_x[first];
+	const float* y = &_y[first];
+	const float* z = &_z[first];
+	const float* radius = &_radius[first];
+	const unsigned char* instances = &_instances[(size_t)first * _stride];
+	unsigned char* out = &_staging[(size_t)first * _stride];
+#ifdef INSTANCE_CULLER_SSE
+	if (AVX)
+		_chunkVisible[chunk] = CullAVX(x, y, z, radius, count, _planes, _viewPos, _maxDistance, instances, _stride, out);
+	else
+		_chunkVisible[chunk] = CullSSE(x, y, z, radius, count, _planes, _viewPos, _maxDistance, instances, _stride, out);
+#else
+	_chunkVisible[chunk] = CullScalar(x, y, z, radius, count, _planes, _viewPos, _maxDistance, instances, _stride, out);
+#endif
+}
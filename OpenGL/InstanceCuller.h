@@ -0,0 +1,70 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+#include "Frustum.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+//Frustum and distance culling for a large set of static instances of one mesh (the asteroid
+//field). Each instance has a bounding sphere, kept as separate x/y/z/radius arrays so the planes
+//are tested against 8 (AVX) or 4 (SSE) spheres per instruction. Chunks of instances are culled
+//on the culler's workers and the calling thread, and the instance data of the survivors is
+//streamed into a compacted GL_ARRAY_BUFFER each frame, so the instanced draw only covers what
+//is on screen.
+class InstanceCuller
+{
+public:
+	//GL thread. Instance i is stride bytes at instances + i * stride, bounded by spheres[i]
+	//(xyz center, w radius) in the space of the frustums passed to Cull.
+	InstanceCuller(const glm::vec4* spheres, const void* instances, unsigned int count, unsigned int stride);
+	~InstanceCuller();
+
+	InstanceCuller(const InstanceCuller&) = delete;
+	InstanceCuller& operator=(const InstanceCuller&) = delete;
+
+	//Buffer of visible instances, for the instance attributes of the VAO
+	GLuint GetBuffer() const { return _buffer; }
+
+	//GL thread, once a frame: culls every instance against frustum, drops those whose sphere is
+	//further than maxDistance from viewPos (both in the space of the spheres, as GpuInstanceCuller)
+	//and uploads the visible ones to the front of the buffer. Returns the instance count to draw.
+	unsigned int Cull(const Frustum& frustum, const glm::vec3& viewPos, float maxDistance);
+
+	unsigned int GetVisibleCount() const { return _visible; }
+	unsigned int GetInstanceCount() const { return _count; }
+
+private:
+	static const unsigned int CHUNK_INSTANCES = 4096;
+
+	unsigned int _count;
+	unsigned int _stride;
+	GLuint _buffer;
+	unsigned int _visible;
+
+	//Padded to a multiple of 8 so the kernels never read past the end
+	std::vector<float> _x, _y, _z, _radius;
+	std::vector<unsigned char> _instances;
+
+	//Survivors of chunk c are written from instance c * CHUNK_INSTANCES of _staging, _chunkVisible[c] of them
+	std::vector<unsigned char> _staging;
+	std::vector<unsigned int> _chunkVisible;
+
+	glm::vec4 _planes[6];
+	glm::vec3 _viewPos;
+	float _maxDistance;
+	std::atomic<unsigned int> _nextChunk;
+	std::mutex _mutex;
+	std::condition_variable _helpersDone;
+	unsigned int _pendingHelpers;
+	ThreadPool _pool;
+
+	unsigned int getChunkCount() const { return (_count + CHUNK_INSTANCES - 1) / CHUNK_INSTANCES; }
+
+	//Takes chunks until none are left
+	void cullChunks();
+	void cullChunk(unsigned int chunk);
+};
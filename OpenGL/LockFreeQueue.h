@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+//Unbounded multi-producer/single-consumer queue (Vyukov). Push may be called from any
+//thread, TryPop only from the one consuming thread.
+template <typename T>
+class LockFreeQueue
+{
+public:
+	LockFreeQueue()
+	{
+		Node* stub = new Node();
+		_head.store(stub, std::memory_order_relaxed);
+		_tail = stub;
+	}
+
+	~LockFreeQueue()
+	{
+		T value;
+		while (TryPop(value))
+		{
+		}
+		delete _tail;
+	}
+
+	LockFreeQueue(const LockFreeQueue&) = delete;
+	LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+	void Push(T value)
+	{
+		Node* node = new Node();
+		node->value = std::move(value);
+		Node* previous = _head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	bool TryPop(T& value)
+	{
+		Node* tail = _tail;
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (!next)
+			return false;
+		value = std::move(next->value);
+		_tail = next;
+		delete tail;
+		return true;
+	}
+
+private:
+	struct Node
+	{
+		std::atomic<Node*> next;
+		T value;
+		Node() : next(nullptr), value() {}
+	};
+
+	std::atomic<Node*> _head; //Producers
+	Node* _tail; //Consumer
+};
@@ -0,0 +1,99 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile() : _data(nullptr), _size(0)
+{
+#ifdef _WIN32
+	_file = nullptr;
+	_mapping = nullptr;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const unsigned char*>(view);
+	_size = (size_t)size.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	_data = static_cast<const unsigned char*>(view);
+	_size = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!_data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle((HANDLE)_mapping);
+	CloseHandle((HANDLE)_file);
+	_file = nullptr;
+	_mapping = nullptr;
+#else
+	munmap((void*)_data, _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+}
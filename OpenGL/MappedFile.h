@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+//Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	const unsigned char* GetData() const { return _data; }
+	size_t GetSize() const { return _size; }
+	bool IsOpen() const { return _data != nullptr; }
+
+private:
+	const unsigned char* _data;
+	size_t _size;
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#endif
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include "Mesh.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <string>
+
+//Minimal Wavefront .mtl reader. Only the texture maps Model uses are kept, using the same
+//type names and order as Model::processMesh (diffuse, specular, normal, height).
+class MaterialLibrary
+{
+public:
+	std::map<std::string, std::vector<TextureRef>> materials;
+
+	bool Load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "Failed to open material library: " << path << std::endl;
+			return false;
+		}
+
+		std::map<std::string, MaterialSlots> slots;
+		MaterialSlots* current = nullptr;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream stream(line);
+			std::string keyword;
+			if (!(stream >> keyword))
+				continue;
+
+			if (keyword == "newmtl")
+			{
+				std::string name = restOfLine(stream);
+				current = &slots[name];
+				continue;
+			}
+			if (!current)
+				continue;
+
+			int slot = slotFor(keyword);
+			if (slot < 0)
+				continue;
+
+			//Assimp keeps a single map per type, so later statements replace earlier ones
+			std::string path = mapPath(restOfLine(stream));
+			if (!path.empty())
+				current->slots[slot] = path;
+		}
+
+		for (std::map<std::string, MaterialSlots>::iterator it = slots.begin(); it != slots.end(); ++it)
+		{
+			std::vector<TextureRef>& textures = materials[it->first];
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if (it->second.slots[slot].empty())
+					continue;
+				TextureRef ref;
+				ref.type = slotType(slot);
+				ref.path = it->second.slots[slot];
+				textures.push_back(ref);
+			}
+		}
+		return true;
+	}
+
+	//Collects the "mtllib" file names referenced by an .obj
+	static std::vector<std::string> FindLibraries(const char* data, size_t size)
+	{
+		std::vector<std::string> libraries;
+		size_t pos = 0;
+		while (pos < size)
+		{
+			size_t end = pos;
+			while (end < size && data[end] != '\n')
+				end++;
+
+			if (end - pos > 7 && std::string(data + pos, 7) == "mtllib ")
+			{
+				std::string name(data + pos + 7, end - pos - 7);
+				while (!name.empty() && (name.back() == '\r' || name.back() == ' ' || name.back() == '\t'))
+					name.pop_back();
+				if (!name.empty())
+					libraries.push_back(name);
+			}
+			pos = end + 1;
+		}
+		return libraries;
+	}
+
+private:
+	struct MaterialSlots
+	{
+		std::string slots[4];
+	};
+
+	static const char* slotType(int slot)
+	{
+		static const char* types[4] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+		return types[slot];
+	}
+
+	static int slotFor(const std::string& keyword)
+	{
+		if (keyword == "map_Kd")
+			return 0;
+		if (keyword == "map_Ks")
+			return 1;
+		if (keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump")
+			return 2;
+		if (keyword == "map_Ka")
+			return 3;
+		return -1;
+	}
+
+	static std::string restOfLine(std::istringstream& stream)
+	{
+		std::string rest;
+		std::getline(stream >> std::ws, rest);
+		while (!rest.empty() && (rest.back() == '\r' || rest.back() == ' ' || rest.back() == '\t'))
+			rest.pop_back();
+		return rest;
+	}
+
+	//Skips map options ("-bm 1.0", "-s 1 1 1", ...) and returns the file name
+	static std::string mapPath(const std::string& line)
+	{
+		size_t pos = 0;
+		bool inOption = false;
+		while (pos < line.size())
+		{
+			pos = line.find_first_not_of(" \t", pos);
+			if (pos == std::string::npos)
+				return std::string();
+
+			size_t end = line.find_first_of(" \t", pos);
+			std::string token = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+
+			char* parsed = nullptr;
+			std::strtod(token.c_str(), &parsed);
+			bool numeric = *parsed == '\0';
+
+			if (token[0] == '-' && !numeric)
+				inOption = true;
+			else if (!(inOption && numeric))
+				return line.substr(pos);
+
+			if (end == std::string::npos)
+				break;
+			pos = end;
+		}
+		return std::string();
+	}
+};
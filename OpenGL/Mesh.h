@@ -2,55 +2,329 @@
 #include <glad/include/glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include "Shader.h"
+#include "ShaderPermutations.h"
+#include "TextureStreamer.h"
+#include "VertexFormat.h"
+#include "GeometryAllocator.h"
+#include "VirtualTexture.h"
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cmath>
 
-struct Vertex {
-	glm::vec3 Position;
-	glm::vec3 Normal;
-	glm::vec2 TexCoords;
+struct Texture {
+	unsigned int id; //GL texture, or VirtualTextureSystem id for "texture_virtual"
+	std::string type;
+	std::string path;
 };
 
-struct Texture {
-	unsigned int id;
+//Unresolved texture reference (type + path relative to the model directory)
+struct TextureRef {
 	std::string type;
 	std::string path;
 };
 
+//Index range drawn for one level of detail. LOD 0 is the full mesh, coarser levels reuse its
+//vertices. error is the object space distance the surface moved from LOD 0.
+struct MeshLod {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	float error;
+};
+
+//CPU-side mesh produced by import, before any GL upload
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+
+	//Used instead of the vectors when the arrays live in a mapped cooked file
+	const Vertex* mappedVertices = nullptr;
+	const unsigned int* mappedIndices = nullptr;
+	unsigned int vertexCount = 0;
+	unsigned int indexCount = 0;
+
+	std::string material;
+	std::vector<TextureRef> textures;
+	std::vector<MeshLod> lods; //Empty means a single level covering every index
+
+	const Vertex* GetVertices() const { return mappedVertices ? mappedVertices : vertices.data(); }
+	const unsigned int* GetIndices() const { return mappedIndices ? mappedIndices : indices.data(); }
+};
+
+//16-bit indices whenever every vertex can be addressed with them
+inline GLenum IndexTypeFor(unsigned int vertexCount)
+{
+	return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+//Range of the shared geometry buffers and CPU arrays for one mesh, shared by every Mesh
+//drawing the same geometry
+class MeshGeometry {
+public:
+	unsigned int VAO; //Shared by every mesh of the same VertexFormat
+	GeometryAllocator::Allocation allocation;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	GLenum indexType;
+	VertexFormat format;
+
+	//Object space bounds: the box, and the sphere around its center that holds every vertex.
+	//Then the dequantisation the vertex shader applies to aPos (identity for VertexFormat::Full).
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+	glm::vec3 positionScale, positionOffset;
+
+	//At least one level, the default covers every index
+	std::vector<MeshLod> lods;
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+
+	//Takes ownership of the arrays and keeps them as the CPU copy
+	MeshGeometry(std::vector<Vertex> vertices, std::vector<unsigned int> indices, VertexFormat format = VertexFormat::Full)
+	{
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->format = format;
+		vertexCount = (unsigned int)this->vertices.size();
+		indexCount = (unsigned int)this->indices.size();
+		setupMesh(this->vertices.data(), vertexCount, this->indices.data(), indexCount);
+	}
+
+	//Uploads straight from external memory (e.g. a mapped cooked file) without keeping a CPU copy
+	MeshGeometry(const Vertex* vertexData, unsigned int vertexCount, const unsigned int* indexData, unsigned int indexCount, VertexFormat format = VertexFormat::Full)
+	{
+		this->vertexCount = vertexCount;
+		this->indexCount = indexCount;
+		this->format = format;
+		setupMesh(vertexData, vertexCount, indexData, indexCount);
+	}
+
+	~MeshGeometry()
+	{
+		GeometryAllocator::Get().Free(allocation);
+	}
+
+	MeshGeometry(const MeshGeometry&) = delete;
+	MeshGeometry& operator=(const MeshGeometry&) = delete;
+
+	size_t GetCpuBytes() const { return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int); }
+
+	//Frees the CPU copy, the GPU buffers stay. Returns the bytes released.
+	size_t ReleaseCpuData()
+	{
+		size_t bytes = GetCpuBytes();
+		std::vector<Vertex>().swap(vertices);
+		std::vector<unsigned int>().swap(indices);
+		return bytes;
+	}
+
+	size_t GetVertexBytes() const { return vertexCount * VertexStride(format); }
+
+	//Arguments for glDrawElementsBaseVertex drawing level
+	GLint GetBaseVertex() const { return (GLint)allocation.baseVertex; }
+	void* GetIndexOffset(const MeshLod& level) const
+	{
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+		return (void*)(allocation.indexOffset + level.firstIndex * indexSize);
+	}
+	//The same offset counted in indices, for indirect draw commands
+	GLuint GetFirstIndex(const MeshLod& level) const
+	{
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+		return (GLuint)(allocation.indexOffset / indexSize) + level.firstIndex;
+	}
+
+	//Sets the aPos dequantisation uniforms. Always set, the same program may draw both formats.
+	void SetDecodeUniforms(const Shader& shader) const
+	{
+		shader.setVec3("positionScale"_u, positionScale);
+		shader.setVec3("positionOffset"_u, positionOffset);
+	}
+
+private:
+	void setupMesh(const Vertex* vertexData, size_t vertexCount, const unsigned int* indexData, size_t indexCount)
+	{
+		boundsMin = glm::vec3(0.0f);
+		boundsMax = glm::vec3(0.0f);
+		if (vertexCount > 0)
+		{
+			boundsMin = boundsMax = vertexData[0].Position;
+			for (size_t i = 1; i < vertexCount; i++)
+			{
+				boundsMin = glm::min(boundsMin, vertexData[i].Position);
+				boundsMax = glm::max(boundsMax, vertexData[i].Position);
+			}
+		}
+		//Tighter than half the box diagonal for round meshes such as the planets
+		boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			glm::vec3 offset = vertexData[i].Position - boundsCenter;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		boundsRadius = std::sqrt(radiusSquared);
+		positionScale = glm::vec3(1.0f);
+		positionOffset = glm::vec3(0.0f);
+
+		MeshLod full = { 0, (unsigned int)indexCount, 0.0f };
+		lods.assign(1, full);
+
+		//Indices are relative to the mesh, the allocation's base vertex offsets them
+		indexType = IndexTypeFor((unsigned int)vertexCount);
+		std::vector<unsigned short> shortIndices;
+		const void* indexBytes = indexData;
+		size_t indexSize = sizeof(unsigned int);
+		if (indexType == GL_UNSIGNED_SHORT)
+		{
+			shortIndices.assign(indexData, indexData + indexCount);
+			indexBytes = shortIndices.data();
+			indexSize = sizeof(unsigned short);
+		}
+
+		std::vector<PackedVertex> packed;
+		const void* vertexBytes = vertexData;
+		if (format == VertexFormat::Packed)
+		{
+			packVertices(vertexData, vertexCount, packed);
+			vertexBytes = packed.data();
+		}
+
+		allocation = GeometryAllocator::Get().Allocate(format, vertexBytes, (unsigned int)vertexCount, indexBytes, indexCount * indexSize);
+		VAO = GeometryAllocator::Get().GetVertexArray(format);
+	}
+
+	void packVertices(const Vertex* vertexData, size_t vertexCount, std::vector<PackedVertex>& packed)
+	{
+		//Flat axes keep a unit scale so the shader never multiplies by zero
+		glm::vec3 extent = boundsMax - boundsMin;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (extent[axis] <= 0.0f)
+				extent[axis] = 1.0f;
+		}
+		positionScale = extent;
+		positionOffset = boundsMin;
+
+		packed.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			const Vertex& vertex = vertexData[i];
+			glm::vec3 position = glm::clamp((vertex.Position - boundsMin) / extent, 0.0f, 1.0f);
+			for (int axis = 0; axis < 3; axis++)
+				packed[i].Position[axis] = (unsigned short)(position[axis] * 65535.0f + 0.5f);
+			packed[i].Position[3] = 0;
+
+			glm::vec3 normal = vertex.Normal;
+			float length = glm::length(normal);
+			normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+			packed[i].Normal = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+
+			packed[i].TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+			packed[i].TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+		}
+	}
+};
+
 class Mesh {
 public:
 
 	unsigned int VAO;
+	unsigned int indexCount; //LOD 0
+	GLenum indexType;
+	unsigned int lod = 0; //Level drawn, picked by Model::SelectLod
+	uint32_t shaderFeatures; //SHADER_* features the textures need, see ShaderPermutations
 
 	//Mesh
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
+	std::shared_ptr<MeshGeometry> geometry;
 	std::vector<Texture> textures;
 
 	//Functions
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, VertexFormat format = VertexFormat::Full)
+		: Mesh(std::make_shared<MeshGeometry>(std::move(vertices), std::move(indices), format), std::move(textures))
+	{
+	}
+
+	Mesh(const Vertex* vertexData, unsigned int vertexCount, const unsigned int* indexData, unsigned int indexCount, std::vector<Texture> textures, VertexFormat format = VertexFormat::Full)
+		: Mesh(std::make_shared<MeshGeometry>(vertexData, vertexCount, indexData, indexCount, format), std::move(textures))
+	{
+	}
+
+	//Shares already uploaded geometry, only the texture set is per Mesh
+	Mesh(std::shared_ptr<MeshGeometry> geometry, std::vector<Texture> textures)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-		setupMesh();
+		this->geometry = std::move(geometry);
+		this->textures = std::move(textures);
+		VAO = this->geometry->VAO;
+		indexCount = this->geometry->lods[0].indexCount;
+		indexType = this->geometry->indexType;
+		shaderFeatures = FeaturesFor(this->textures);
 	}
 
-	void Draw(Shader shader)
+	//Permutation features for a texture set, maps that aren't there are never sampled
+	static uint32_t FeaturesFor(const std::vector<Texture>& textures)
+	{
+		uint32_t features = 0;
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].type == "texture_specular")
+				features |= SHADER_SPECULAR_MAP;
+			else if (textures[i].type == "texture_normal")
+				features |= SHADER_NORMAL_MAP;
+			else if (textures[i].type == "texture_height")
+				features |= SHADER_HEIGHT_MAP;
+		}
+		return features;
+	}
+
+	void Draw(const Shader& shader)
+	{
+		if (samplerNames.size() != textures.size())
+			hashSamplerNames();
+
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].type == "texture_virtual")
+			{
+				VirtualTextureSystem::Get().Bind(textures[i].id, shader, i);
+				continue;
+			}
+			shader.setInt(samplerNames[i], i);
+			GLState::Get().BindTexture(i, GL_TEXTURE_2D, TextureStreamer::Get().Resolve(textures[i].id));
+		}
+
+
+		geometry->SetDecodeUniforms(shader);
+
+		//Draw
+		//Every mesh of a format shares the VAO, so it stays bound between draws
+		const MeshLod& level = geometry->lods[lod < geometry->lods.size() ? lod : 0];
+		GLState::Get().BindVertexArray(VAO);
+		glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, geometry->GetIndexOffset(level), geometry->GetBaseVertex());
+	}
+
+private:
+	std::vector<UniformId> samplerNames; //"material.texture_diffuse1" etc. per texture, hashed once
+
+	void hashSamplerNames()
 	{
 		unsigned int diffuseNum = 1;
 		unsigned int specularNum = 1;
 		unsigned int normalNr = 1;
 		unsigned int heightNr = 1;
+		samplerNames.clear();
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-
 			std::string number;
-			std::string name = textures[i].type;
+			const std::string& name = textures[i].type;
 			if (name == "texture_diffuse")
 				number = std::to_string(diffuseNum++);
 			else if (name == "texture_specular")
@@ -58,51 +332,10 @@ public:
 			else if (name == "texture_normal")
 				number = std::to_string(normalNr++);
 			else if (name == "texture_height")
-				number = std::to_string(heightNr++); 
+				number = std::to_string(heightNr++);
 
-			shader.setInt(("material." + name + number).c_str(), i);
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			std::string uniform = "material." + name + number;
+			samplerNames.push_back(UniformId{ HashUniformName(uniform.c_str(), uniform.size()) });
 		}
-
-
-		//Draw
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		glActiveTexture(GL_TEXTURE0);
-	}
-
-private:
-	unsigned int VBO, EBO;
-	void setupMesh()
-	{
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
-		//Assign Data to Vertex
-		glBindVertexArray(VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		//Assign Data to Indices
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		//Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-
-		//Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-
-		//Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
 	}
 };
-
@@ -0,0 +1,296 @@
+#include "MeshCache.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+//Cooked file layout
+//	CookedHeader
+//	CookedMeshRecord[meshCount]
+//	CookedTextureRecord[textureCount]
+//	CookedLodRecord[lodCount]
+//	String data
+//	Vertex/index data (16 byte aligned per array)
+namespace
+{
+	const uint32_t COOKED_MAGIC = 0x434D444C; //"LDMC"
+	const uint32_t COOKED_VERSION = 4; //4: LOD index ranges
+	const uint64_t COOKED_ALIGN = 16;
+
+	struct CookedHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t vertexSize;
+		uint32_t meshCount;
+		uint32_t textureCount;
+		uint32_t lodCount;
+	};
+
+	struct CookedMeshRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t firstTexture;
+		uint32_t textureCount;
+		uint32_t materialOffset;
+		uint32_t materialLength;
+		uint32_t firstLod;
+		uint32_t lodCount;
+	};
+
+	struct CookedTextureRecord
+	{
+		uint32_t typeOffset;
+		uint32_t typeLength;
+		uint32_t pathOffset;
+		uint32_t pathLength;
+	};
+
+	struct CookedLodRecord
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t reserved;
+	};
+
+	uint64_t AlignUp(uint64_t value)
+	{
+		return (value + COOKED_ALIGN - 1) & ~(COOKED_ALIGN - 1);
+	}
+
+	bool InRange(uint64_t offset, uint64_t length, size_t fileSize)
+	{
+		return offset <= fileSize && length <= fileSize - offset;
+	}
+}
+
+uint64_t MeshCache::Hash(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool MeshCache::HashFile(const std::string& path, uint64_t& hash)
+{
+	MappedFile file;
+	if (!file.Open(path))
+		return false;
+	hash = Hash(file.GetData(), file.GetSize());
+	return true;
+}
+
+bool MeshCache::Load(const std::string& cookedPath, uint64_t sourceHash, MappedFile& file, std::vector<MeshData>& meshes)
+{
+	if (!file.Open(cookedPath))
+		return false;
+
+	const unsigned char* data = file.GetData();
+	size_t size = file.GetSize();
+	if (size < sizeof(CookedHeader))
+	{
+		file.Close();
+		return false;
+	}
+
+	CookedHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != COOKED_MAGIC || header.version != COOKED_VERSION || header.sourceHash != sourceHash || header.vertexSize != sizeof(Vertex))
+	{
+		file.Close();
+		return false;
+	}
+
+	uint64_t meshTable = sizeof(CookedHeader);
+	uint64_t textureTable = meshTable + (uint64_t)header.meshCount * sizeof(CookedMeshRecord);
+	uint64_t lodTable = textureTable + (uint64_t)header.textureCount * sizeof(CookedTextureRecord);
+	if (!InRange(meshTable, (uint64_t)header.meshCount * sizeof(CookedMeshRecord), size) ||
+		!InRange(textureTable, (uint64_t)header.textureCount * sizeof(CookedTextureRecord), size) ||
+		!InRange(lodTable, (uint64_t)header.lodCount * sizeof(CookedLodRecord), size))
+	{
+		std::cout << "Cooked mesh file is truncated: " << cookedPath << std::endl;
+		file.Close();
+		return false;
+	}
+
+	meshes.clear();
+	meshes.reserve(header.meshCount);
+	for (unsigned int i = 0; i < header.meshCount; i++)
+	{
+		CookedMeshRecord record;
+		std::memcpy(&record, data + meshTable + i * sizeof(CookedMeshRecord), sizeof(record));
+
+		if (!InRange(record.vertexOffset, (uint64_t)record.vertexCount * sizeof(Vertex), size) ||
+			!InRange(record.indexOffset, (uint64_t)record.indexCount * sizeof(unsigned int), size) ||
+			!InRange(record.materialOffset, record.materialLength, size) ||
+			(uint64_t)record.firstTexture + record.textureCount > header.textureCount ||
+			(uint64_t)record.firstLod + record.lodCount > header.lodCount)
+		{
+			std::cout << "Cooked mesh file is corrupt: " << cookedPath << std::endl;
+			file.Close();
+			meshes.clear();
+			return false;
+		}
+
+		MeshData view;
+		view.mappedVertices = reinterpret_cast<const Vertex*>(data + record.vertexOffset);
+		view.vertexCount = record.vertexCount;
+		view.mappedIndices = reinterpret_cast<const unsigned int*>(data + record.indexOffset);
+		view.indexCount = record.indexCount;
+		view.material.assign(reinterpret_cast<const char*>(data + record.materialOffset), record.materialLength);
+
+		for (unsigned int t = 0; t < record.textureCount; t++)
+		{
+			CookedTextureRecord texture;
+			std::memcpy(&texture, data + textureTable + (record.firstTexture + t) * sizeof(CookedTextureRecord), sizeof(texture));
+			if (!InRange(texture.typeOffset, texture.typeLength, size) || !InRange(texture.pathOffset, texture.pathLength, size))
+			{
+				file.Close();
+				meshes.clear();
+				return false;
+			}
+
+			TextureRef ref;
+			ref.type.assign(reinterpret_cast<const char*>(data + texture.typeOffset), texture.typeLength);
+			ref.path.assign(reinterpret_cast<const char*>(data + texture.pathOffset), texture.pathLength);
+			view.textures.push_back(ref);
+		}
+
+		for (unsigned int l = 0; l < record.lodCount; l++)
+		{
+			CookedLodRecord lodRecord;
+			std::memcpy(&lodRecord, data + lodTable + (record.firstLod + l) * sizeof(CookedLodRecord), sizeof(lodRecord));
+			if ((uint64_t)lodRecord.firstIndex + lodRecord.indexCount > record.indexCount)
+			{
+				std::cout << "Cooked mesh file is corrupt: " << cookedPath << std::endl;
+				file.Close();
+				meshes.clear();
+				return false;
+			}
+
+			MeshLod lod = { lodRecord.firstIndex, lodRecord.indexCount, lodRecord.error };
+			view.lods.push_back(lod);
+		}
+		meshes.push_back(view);
+	}
+	return true;
+}
+
+bool MeshCache::Save(const std::string& cookedPath, uint64_t sourceHash, const std::vector<MeshData>& meshes)
+{
+	CookedHeader header;
+	header.magic = COOKED_MAGIC;
+	header.version = COOKED_VERSION;
+	header.sourceHash = sourceHash;
+	header.vertexSize = sizeof(Vertex);
+	header.meshCount = (uint32_t)meshes.size();
+	header.textureCount = 0;
+	header.lodCount = 0;
+	std::vector<CookedLodRecord> lodRecords;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		header.textureCount += (uint32_t)meshes[i].textures.size();
+		for (unsigned int l = 0; l < meshes[i].lods.size(); l++)
+		{
+			CookedLodRecord record;
+			record.firstIndex = meshes[i].lods[l].firstIndex;
+			record.indexCount = meshes[i].lods[l].indexCount;
+			record.error = meshes[i].lods[l].error;
+			record.reserved = 0;
+			lodRecords.push_back(record);
+		}
+	}
+	header.lodCount = (uint32_t)lodRecords.size();
+
+	//Lay out the string data straight after the tables
+	uint64_t offset = sizeof(CookedHeader) + header.meshCount * sizeof(CookedMeshRecord) + header.textureCount * sizeof(CookedTextureRecord) +
+		header.lodCount * sizeof(CookedLodRecord);
+	std::vector<CookedTextureRecord> textureRecords;
+	std::vector<uint32_t> materialOffsets;
+	std::string strings;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		materialOffsets.push_back((uint32_t)(offset + strings.size()));
+		strings += meshes[i].material;
+		for (unsigned int t = 0; t < meshes[i].textures.size(); t++)
+		{
+			const TextureRef& texture = meshes[i].textures[t];
+			CookedTextureRecord record;
+			record.typeOffset = (uint32_t)(offset + strings.size());
+			record.typeLength = (uint32_t)texture.type.size();
+			strings += texture.type;
+			record.pathOffset = (uint32_t)(offset + strings.size());
+			record.pathLength = (uint32_t)texture.path.size();
+			strings += texture.path;
+			textureRecords.push_back(record);
+		}
+	}
+	offset = AlignUp(offset + strings.size());
+
+	//Then the geometry arrays
+	std::vector<CookedMeshRecord> meshRecords;
+	uint32_t firstTexture = 0;
+	uint32_t firstLod = 0;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		CookedMeshRecord record;
+		record.vertexCount = meshes[i].vertexCount;
+		record.indexCount = meshes[i].indexCount;
+		record.vertexOffset = offset;
+		offset = AlignUp(offset + record.vertexCount * sizeof(Vertex));
+		record.indexOffset = offset;
+		offset = AlignUp(offset + record.indexCount * sizeof(unsigned int));
+		record.firstTexture = firstTexture;
+		record.textureCount = (uint32_t)meshes[i].textures.size();
+		record.materialOffset = materialOffsets[i];
+		record.materialLength = (uint32_t)meshes[i].material.size();
+		record.firstLod = firstLod;
+		record.lodCount = (uint32_t)meshes[i].lods.size();
+		firstTexture += record.textureCount;
+		firstLod += record.lodCount;
+		meshRecords.push_back(record);
+	}
+
+	std::ofstream out(cookedPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "Failed to write cooked mesh: " << cookedPath << std::endl;
+		return false;
+	}
+
+	static const char padding[COOKED_ALIGN] = {};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!meshRecords.empty())
+		out.write(reinterpret_cast<const char*>(&meshRecords[0]), meshRecords.size() * sizeof(CookedMeshRecord));
+	if (!textureRecords.empty())
+		out.write(reinterpret_cast<const char*>(&textureRecords[0]), textureRecords.size() * sizeof(CookedTextureRecord));
+	if (!lodRecords.empty())
+		out.write(reinterpret_cast<const char*>(&lodRecords[0]), lodRecords.size() * sizeof(CookedLodRecord));
+	out.write(strings.data(), strings.size());
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		out.write(padding, (std::streamsize)(meshRecords[i].vertexOffset - (uint64_t)out.tellp()));
+		out.write(reinterpret_cast<const char*>(meshes[i].GetVertices()), meshes[i].vertexCount * sizeof(Vertex));
+		out.write(padding, (std::streamsize)(meshRecords[i].indexOffset - (uint64_t)out.tellp()));
+		out.write(reinterpret_cast<const char*>(meshes[i].GetIndices()), meshes[i].indexCount * sizeof(unsigned int));
+	}
+
+	if (!out)
+	{
+		std::cout << "Failed to write cooked mesh: " << cookedPath << std::endl;
+		out.close();
+		std::remove(cookedPath.c_str());
+		return false;
+	}
+	return true;
+}
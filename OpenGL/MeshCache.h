@@ -0,0 +1,25 @@
+#pragma once
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <vector>
+#include <string>
+
+//Binary cache of the final Vertex/index arrays and LOD ranges produced by Model::ImportGeometry.
+//Cooked files live next to the source ("planet.obj.cooked") and are only used while
+//the hash of the source contents matches the one recorded when they were written.
+class MeshCache
+{
+public:
+	static std::string CookedPath(const std::string& sourcePath) { return sourcePath + ".cooked"; }
+
+	//FNV-1a 64
+	static uint64_t Hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL);
+	static bool HashFile(const std::string& path, uint64_t& hash);
+
+	//Maps cookedPath and fills meshes when it was cooked from a source with sourceHash.
+	//The mesh arrays point into file and are only valid while it stays mapped.
+	static bool Load(const std::string& cookedPath, uint64_t sourceHash, MappedFile& file, std::vector<MeshData>& meshes);
+	static bool Save(const std::string& cookedPath, uint64_t sourceHash, const std::vector<MeshData>& meshes);
+};
@@ -0,0 +1,366 @@
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+	//Forsyth, "Linear-Speed Vertex Cache Optimisation"
+	const int CACHE_SIZE = 32;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	//FIFO size used to find cluster boundaries and to measure ACMR
+	const unsigned int FIFO_CACHE_SIZE = 16;
+
+	float vertexScore(int cachePosition, unsigned int remaining)
+	{
+		//No triangles left to draw, never pick it
+		if (remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			//The last triangle's vertices get a fixed score so the next one doesn't just reuse its edge
+			if (cachePosition < 3)
+				score = LAST_TRIANGLE_SCORE;
+			else
+				score = std::pow(1.0f - (cachePosition - 3) / float(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+		}
+
+		//Favour vertices with few triangles left so they get finished and leave the cache
+		score += VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	struct VertexHasher
+	{
+		const Vertex* vertices;
+		size_t operator()(unsigned int index) const
+		{
+			return (size_t)MeshCache::Hash(&vertices[index], sizeof(Vertex));
+		}
+	};
+
+	struct VertexEqual
+	{
+		const Vertex* vertices;
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			return std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex)) == 0;
+		}
+	};
+}
+
+void MeshOptimizer::Optimize(MeshData& mesh, const std::string& name)
+{
+	//Cooked meshes are already optimised
+	if (mesh.mappedVertices || mesh.indices.empty())
+		return;
+
+	unsigned int importedVertices = (unsigned int)mesh.vertices.size();
+	float importedACMR = ComputeACMR(mesh.indices.data(), mesh.indices.size(), importedVertices);
+
+	Weld(mesh);
+	float weldedACMR = ComputeACMR(mesh.indices.data(), mesh.indices.size(), (unsigned int)mesh.vertices.size());
+
+	OptimizeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+	OptimizeOverdraw(mesh.indices, mesh.vertices);
+	OptimizeVertexFetch(mesh);
+
+	mesh.vertexCount = (unsigned int)mesh.vertices.size();
+	mesh.indexCount = (unsigned int)mesh.indices.size();
+	float optimisedACMR = ComputeACMR(mesh.indices.data(), mesh.indices.size(), mesh.vertexCount);
+
+	std::cout << std::fixed << std::setprecision(3)
+		<< "Optimised " << name << ": " << importedVertices << " -> " << mesh.vertexCount << " vertices, ACMR "
+		<< importedACMR << " -> " << optimisedACMR << " (welded " << weldedACMR << "), "
+		<< (IndexTypeFor(mesh.vertexCount) == GL_UNSIGNED_SHORT ? "16" : "32") << "-bit indices" << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+}
+
+void MeshOptimizer::Weld(MeshData& mesh)
+{
+	const std::vector<Vertex>& vertices = mesh.vertices;
+	VertexHasher hasher = { vertices.data() };
+	VertexEqual equal = { vertices.data() };
+	std::unordered_map<unsigned int, unsigned int, VertexHasher, VertexEqual> unique(vertices.size(), hasher, equal);
+
+	std::vector<unsigned int> remap(vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(vertices.size());
+	for (unsigned int i = 0; i < vertices.size(); i++)
+	{
+		std::pair<std::unordered_map<unsigned int, unsigned int, VertexHasher, VertexEqual>::iterator, bool> inserted =
+			unique.insert(std::make_pair(i, (unsigned int)welded.size()));
+		if (inserted.second)
+			welded.push_back(vertices[i]);
+		remap[i] = inserted.first->second;
+	}
+
+	for (unsigned int i = 0; i < mesh.indices.size(); i++)
+		mesh.indices[i] = remap[mesh.indices[i]];
+
+	unique.clear();
+	mesh.vertices.swap(welded);
+	mesh.vertexCount = (unsigned int)mesh.vertices.size();
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	//Triangles using each vertex. The first remaining[v] entries of a vertex's list are the
+	//triangles not yet emitted.
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (unsigned int v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++)
+		score[v] = vertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+	std::vector<unsigned int> cache, nextCache, touched;
+	cache.reserve(CACHE_SIZE + 3);
+	nextCache.reserve(CACHE_SIZE + 3);
+
+	size_t scan = 0;
+	long long best = -1;
+	while (result.size() < triangleCount * 3)
+	{
+		//Nothing in the cache has triangles left, restart from the next unemitted one
+		if (best < 0)
+		{
+			while (emitted[scan])
+				scan++;
+			best = (long long)scan;
+		}
+
+		const unsigned int* triangle = &indices[(size_t)best * 3];
+		emitted[(size_t)best] = true;
+		nextCache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			result.push_back(v);
+
+			unsigned int* list = &adjacency[offsets[v]];
+			unsigned int* end = list + remaining[v];
+			unsigned int* found = std::find(list, end, (unsigned int)best);
+			if (found != end)
+			{
+				std::swap(*found, *(end - 1));
+				remaining[v]--;
+			}
+
+			if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+				nextCache.push_back(v);
+		}
+
+		//Emitted vertices move to the front, the rest shift back and may fall out
+		for (unsigned int i = 0; i < cache.size(); i++)
+		{
+			if (std::find(nextCache.begin(), nextCache.end(), cache[i]) == nextCache.end())
+				nextCache.push_back(cache[i]);
+		}
+
+		touched.clear();
+		for (unsigned int i = 0; i < nextCache.size(); i++)
+		{
+			unsigned int v = nextCache[i];
+			cachePosition[v] = i < (unsigned int)CACHE_SIZE ? (int)i : -1;
+			touched.push_back(v);
+		}
+		if (nextCache.size() > (size_t)CACHE_SIZE)
+			nextCache.resize(CACHE_SIZE);
+		cache.swap(nextCache);
+
+		//Push score changes to the triangles still waiting on those vertices
+		for (unsigned int i = 0; i < touched.size(); i++)
+		{
+			unsigned int v = touched[i];
+			float newScore = vertexScore(cachePosition[v], remaining[v]);
+			float delta = newScore - score[v];
+			score[v] = newScore;
+			for (unsigned int j = 0; j < remaining[v]; j++)
+				triangleScore[adjacency[offsets[v] + j]] += delta;
+		}
+
+		//Best triangle touching the cache
+		best = -1;
+		float bestScore = -1.0f;
+		for (unsigned int i = 0; i < cache.size(); i++)
+		{
+			unsigned int v = cache[i];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				unsigned int t = adjacency[offsets[v] + j];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	//Any trailing indices that don't form a triangle are kept as they were
+	result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	//Clusters start wherever the cache order has to restart (a triangle missing on all three vertices),
+	//so moving whole clusters around costs little cache efficiency
+	std::vector<size_t> clusterStart;
+	std::vector<unsigned int> cacheTime(vertices.size(), 0);
+	unsigned int time = FIFO_CACHE_SIZE + 1;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[t * 3 + k];
+			if (time - cacheTime[v] > FIFO_CACHE_SIZE)
+			{
+				cacheTime[v] = time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3)
+			clusterStart.push_back(t);
+	}
+	clusterStart.push_back(triangleCount);
+	size_t clusterCount = clusterStart.size() - 1;
+	if (clusterCount < 2)
+		return;
+
+	//Area weighted centroid and normal per cluster
+	std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+	std::vector<float> clusterArea(clusterCount, 0.0f);
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+		{
+			const glm::vec3& a = vertices[indices[t * 3]].Position;
+			const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+			const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+			glm::vec3 normal = glm::cross(b - a, d - a);
+			float area = glm::length(normal);
+			clusterCentroid[c] += (a + b + d) * (area / 3.0f);
+			clusterNormal[c] += normal;
+			clusterArea[c] += area;
+		}
+		meshCentroid += clusterCentroid[c];
+		meshArea += clusterArea[c];
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	//Clusters facing away from the centre are more likely to occlude the rest, draw them first
+	std::vector<float> sortKey(clusterCount, 0.0f);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float normalLength = glm::length(clusterNormal[c]);
+		if (clusterArea[c] <= 0.0f || normalLength <= 0.0f)
+			continue;
+		glm::vec3 centroid = clusterCentroid[c] / clusterArea[c];
+		sortKey[c] = glm::dot(centroid - meshCentroid, clusterNormal[c] / normalLength);
+	}
+
+	std::vector<size_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&sortKey](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i < clusterCount; i++)
+	{
+		size_t c = order[i];
+		result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+	}
+	result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(MeshData& mesh)
+{
+	const unsigned int unused = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(mesh.vertices.size(), unused);
+	std::vector<Vertex> ordered;
+	ordered.reserve(mesh.vertices.size());
+	for (unsigned int i = 0; i < mesh.indices.size(); i++)
+	{
+		unsigned int& index = mesh.indices[i];
+		if (remap[index] == unused)
+		{
+			remap[index] = (unsigned int)ordered.size();
+			ordered.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	//Vertices no triangle uses are dropped
+	mesh.vertices.swap(ordered);
+	mesh.vertexCount = (unsigned int)mesh.vertices.size();
+}
+
+float MeshOptimizer::ComputeACMR(const unsigned int* indices, size_t indexCount, unsigned int vertexCount, unsigned int cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return 0.0f;
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		unsigned int v = indices[i];
+		if (time - cacheTime[v] > cacheSize)
+		{
+			cacheTime[v] = time++;
+			misses++;
+		}
+	}
+	return (float)misses / (float)triangleCount;
+}
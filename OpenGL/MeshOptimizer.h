@@ -0,0 +1,31 @@
+#pragma once
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+
+//Import-time mesh optimisation, run on the CPU arrays before they are cooked.
+//Welds duplicate vertices, orders triangles for the post-transform cache (Forsyth) and
+//overdraw (Sander et al. cluster sort), then orders vertices by first use for fetch locality.
+class MeshOptimizer
+{
+public:
+	//Runs every stage on mesh and prints a before/after report labelled name
+	static void Optimize(MeshData& mesh, const std::string& name);
+
+	//Merges bitwise identical vertices and remaps the indices
+	static void Weld(MeshData& mesh);
+
+	//Reorders triangles to maximise post-transform vertex cache hits
+	static void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount);
+
+	//Splits the cache ordered triangles into clusters and draws outward facing clusters first.
+	//Triangle order inside a cluster is kept so cache efficiency is mostly preserved.
+	static void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices);
+
+	//Renumbers vertices in order of first use and reorders the vertex array to match
+	static void OptimizeVertexFetch(MeshData& mesh);
+
+	//Average cache miss ratio: transformed vertices per triangle for a FIFO cache of cacheSize
+	static float ComputeACMR(const unsigned int* indices, size_t indexCount, unsigned int vertexCount, unsigned int cacheSize = 16);
+};
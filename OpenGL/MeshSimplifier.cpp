@@ -0,0 +1,344 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const unsigned int MAX_LODS = 8;
+	const size_t MIN_LOD_TRIANGLES = 32;
+
+	//Plane distance quadric, weighted by triangle area so error() is a squared distance
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, w;
+
+		void AddPlane(const glm::dvec3& n, double d, double weight)
+		{
+			a2 += weight * n.x * n.x; ab += weight * n.x * n.y; ac += weight * n.x * n.z; ad += weight * n.x * d;
+			b2 += weight * n.y * n.y; bc += weight * n.y * n.z; bd += weight * n.y * d;
+			c2 += weight * n.z * n.z; cd += weight * n.z * d;
+			d2 += weight * d * d;
+			w += weight;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			w += q.w;
+		}
+
+		double Error(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z
+				+ d2;
+			return w > 0.0 ? std::fabs(e) / w : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+
+	//Positions snapped to a grid so seams exported with slightly different coordinates still match
+	struct GridHasher
+	{
+		size_t operator()(const glm::ivec3& p) const { return (size_t)MeshCache::Hash(&p, sizeof(p)); }
+	};
+
+	uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	}
+}
+
+std::vector<unsigned int> MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const unsigned int* indices, size_t indexCount,
+	size_t targetIndexCount, float maxError, float& error)
+{
+	std::vector<unsigned int> result(indices, indices + indexCount / 3 * 3);
+	size_t vertexCount = vertices.size();
+	error = 0.0f;
+
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		boundsMin = glm::min(boundsMin, vertices[i].Position);
+		boundsMax = glm::max(boundsMax, vertices[i].Position);
+	}
+	float gridSize = std::max(glm::length(boundsMax - boundsMin) * 1e-4f, FLT_MIN);
+
+	//Vertices split on a UV or normal seam share a position. A seam vertex with a single twin can
+	//collapse along the seam together with its twin; larger groups (poles, corners) are locked.
+	std::vector<unsigned int> canonical(vertexCount), twin(vertexCount), groupSize(vertexCount, 0);
+	std::unordered_map<glm::ivec3, unsigned int, GridHasher> positions;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		glm::ivec3 cell = glm::ivec3(glm::round((vertices[i].Position - boundsMin) / gridSize));
+		std::pair<std::unordered_map<glm::ivec3, unsigned int, GridHasher>::iterator, bool> inserted =
+			positions.insert(std::make_pair(cell, (unsigned int)i));
+		canonical[i] = inserted.first->second;
+		groupSize[canonical[i]]++;
+		twin[i] = (unsigned int)i;
+		if (!inserted.second)
+		{
+			twin[i] = canonical[i];
+			twin[canonical[i]] = (unsigned int)i;
+		}
+	}
+
+	//Once seams are joined every edge should have two triangles. Open borders and non-manifold
+	//edges are locked as well.
+	std::vector<bool> lockedGroup(vertexCount, false);
+	std::unordered_map<uint64_t, unsigned int> edgeUse;
+	for (size_t t = 0; t < result.size(); t += 3)
+	{
+		for (int k = 0; k < 3; k++)
+			edgeUse[edgeKey(canonical[result[t + k]], canonical[result[t + (k + 1) % 3]])]++;
+	}
+	for (std::unordered_map<uint64_t, unsigned int>::const_iterator it = edgeUse.begin(); it != edgeUse.end(); ++it)
+	{
+		if (it->second != 2)
+		{
+			lockedGroup[(size_t)(it->first >> 32)] = true;
+			lockedGroup[(size_t)(it->first & 0xFFFFFFFF)] = true;
+		}
+	}
+
+	std::vector<bool> locked(vertexCount), seam(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		unsigned int group = canonical[i];
+		locked[i] = lockedGroup[group] || groupSize[group] > 2;
+		seam[i] = !locked[i] && groupSize[group] == 2;
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric());
+	for (size_t t = 0; t < result.size(); t += 3)
+	{
+		glm::dvec3 p0(vertices[result[t]].Position), p1(vertices[result[t + 1]].Position), p2(vertices[result[t + 2]].Position);
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(normal);
+		if (length <= 0.0)
+			continue;
+		normal /= length;
+		double d = -glm::dot(normal, p0);
+		for (int k = 0; k < 3; k++)
+			quadrics[result[t + k]].AddPlane(normal, d, length * 0.5);
+	}
+
+	//Seam vertices may only move onto another seam vertex, taking their twin along
+	auto collapseCost = [&](unsigned int from, unsigned int to)
+	{
+		if (locked[from] || (seam[from] && !seam[to]))
+			return DBL_MAX;
+		Quadric q = quadrics[from];
+		q.Add(quadrics[to]);
+		if (seam[from])
+		{
+			q.Add(quadrics[twin[from]]);
+			q.Add(quadrics[twin[to]]);
+		}
+		return q.Error(vertices[to].Position);
+	};
+
+	double maxCost = (double)maxError * (double)maxError;
+	double reachedCost = 0.0;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<unsigned int> offsets(vertexCount + 1), adjacency;
+	std::vector<Collapse> collapses;
+
+	//Counts the triangles around from that a collapse onto to removes, or returns false if one of
+	//the others would flip
+	auto checkCollapse = [&](unsigned int from, unsigned int to, size_t& collapsing)
+	{
+		const glm::vec3& target = vertices[to].Position;
+		for (unsigned int j = offsets[from]; j < offsets[from + 1]; j++)
+		{
+			const unsigned int* triangle = &result[adjacency[j] * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				collapsing++;
+				continue;
+			}
+
+			glm::vec3 before[3], after[3];
+			for (int k = 0; k < 3; k++)
+			{
+				before[k] = vertices[triangle[k]].Position;
+				after[k] = triangle[k] == from ? target : before[k];
+			}
+			glm::vec3 oldNormal = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 newNormal = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(oldNormal, newNormal) <= 0.0f)
+				return false;
+		}
+		return true;
+	};
+
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+
+		collapses.clear();
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = result[t + k];
+				unsigned int b = result[t + (k + 1) % 3];
+				if (a > b)
+					continue; //Interior edges are seen from both triangles, evaluate once
+
+				Collapse collapse = { a, b, collapseCost(a, b) };
+				double cost = collapseCost(b, a);
+				if (cost < collapse.cost)
+					collapse = { b, a, cost };
+				if (collapse.cost < DBL_MAX)
+					collapses.push_back(collapse);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		//Triangles around each vertex, for the flip test
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t i = 0; i < result.size(); i++)
+			offsets[result[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(result.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t targetTriangles = targetIndexCount / 3;
+		size_t removed = 0;
+		bool limited = false;
+		for (size_t c = 0; c < collapses.size() && triangleCount - removed > targetTriangles; c++)
+		{
+			const Collapse& collapse = collapses[c];
+			if (collapse.cost > maxCost)
+			{
+				limited = true;
+				break;
+			}
+
+			//A seam collapse moves both sides, and the twins must share the same seam edge
+			unsigned int from[2] = { collapse.from, twin[collapse.from] };
+			unsigned int to[2] = { collapse.to, twin[collapse.to] };
+			int count = seam[collapse.from] ? 2 : 1;
+			if (count == 2)
+			{
+				bool twinEdge = false;
+				for (unsigned int j = offsets[from[1]]; j < offsets[from[1] + 1] && !twinEdge; j++)
+				{
+					const unsigned int* triangle = &result[adjacency[j] * 3];
+					twinEdge = triangle[0] == to[1] || triangle[1] == to[1] || triangle[2] == to[1];
+				}
+				if (!twinEdge || from[1] == to[0])
+					continue;
+			}
+
+			bool valid = true;
+			size_t collapsing = 0;
+			for (int i = 0; i < count && valid; i++)
+				valid = !touched[from[i]] && !touched[to[i]] && checkCollapse(from[i], to[i], collapsing);
+			if (!valid)
+				continue;
+
+			for (int i = 0; i < count; i++)
+			{
+				remap[from[i]] = to[i];
+				quadrics[to[i]].Add(quadrics[from[i]]);
+
+				//The whole one-ring changes shape, leave it alone until the next pass
+				for (unsigned int j = offsets[from[i]]; j < offsets[from[i] + 1]; j++)
+				{
+					const unsigned int* triangle = &result[adjacency[j] * 3];
+					for (int k = 0; k < 3; k++)
+						touched[triangle[k]] = true;
+				}
+			}
+			reachedCost = std::max(reachedCost, collapse.cost);
+			removed += collapsing;
+		}
+
+		if (removed == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			unsigned int a = remap[result[t]], b = remap[result[t + 1]], d = remap[result[t + 2]];
+			if (a == b || b == d || a == d)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = d;
+		}
+		result.resize(write);
+
+		if (limited)
+			break;
+	}
+
+	error = (float)std::sqrt(reachedCost);
+	return result;
+}
+
+void MeshSimplifier::BuildLods(MeshData& mesh, const std::string& name)
+{
+	mesh.lods.clear();
+	if (mesh.mappedVertices || mesh.indices.empty())
+		return;
+
+	MeshLod full = { 0, (unsigned int)mesh.indices.size(), 0.0f };
+	mesh.lods.push_back(full);
+
+	std::vector<unsigned int> previous(mesh.indices);
+	float error = 0.0f;
+	std::cout << "LODs for " << name << ": " << previous.size() / 3;
+	while (mesh.lods.size() < MAX_LODS)
+	{
+		size_t target = previous.size() / 6 * 3;
+		if (target < MIN_LOD_TRIANGLES * 3)
+			break;
+
+		float levelError = 0.0f;
+		std::vector<unsigned int> level = Simplify(mesh.vertices, previous.data(), previous.size(), target, FLT_MAX, levelError);
+
+		//Stalled on locked seams, further levels wouldn't get any cheaper
+		if (level.size() * 10 > previous.size() * 9)
+			break;
+
+		MeshOptimizer::OptimizeVertexCache(level, (unsigned int)mesh.vertices.size());
+
+		//Each level is simplified from the previous one, so the errors add up
+		error += levelError;
+		MeshLod lod = { (unsigned int)mesh.indices.size(), (unsigned int)level.size(), error };
+		mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+		mesh.lods.push_back(lod);
+		std::cout << " -> " << level.size() / 3;
+		previous.swap(level);
+	}
+	std::cout << " triangles" << std::endl;
+	mesh.indexCount = (unsigned int)mesh.indices.size();
+}
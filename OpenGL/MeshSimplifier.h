@@ -0,0 +1,20 @@
+#pragma once
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+
+//Quadric error edge collapse simplification (Garland & Heckbert) used to build LOD chains.
+//Collapses move a vertex onto a neighbour, so every level reuses the LOD 0 vertex array and only
+//adds an index range. UV seams, hard edges and open borders are locked to keep the surface intact.
+class MeshSimplifier
+{
+public:
+	//Collapses edges until targetIndexCount is reached or the next collapse would move the surface
+	//further than maxError. Returns the new indices into vertices; error is the deviation reached.
+	static std::vector<unsigned int> Simplify(const std::vector<Vertex>& vertices, const unsigned int* indices, size_t indexCount,
+		size_t targetIndexCount, float maxError, float& error);
+
+	//Appends coarser levels, halving the triangle count each time, to mesh.indices and fills mesh.lods
+	static void BuildLods(MeshData& mesh, const std::string& name);
+};
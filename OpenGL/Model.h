@@ -8,48 +8,440 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjParser.h"
+#include "RenderQueue.h"
+#include "GeometryRegistry.h"
+#include "MaterialLibrary.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 #include "stb_image.h"
 
 #include <vector>
 #include <string>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <cmath>
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
+unsigned int TextureFromFile(const char* path, const std::string& directory, TextureUsage usage = TextureUsage::Color);
+
+//CPU-side result of importing a model file. Built without touching GL so it can be
+//filled in on a worker thread and handed to Model::Upload on the GL thread.
+struct ModelData
+{
+	std::string path;
+	uint64_t contentHash = 0; //Source file alone, keys shared geometry
+	uint64_t cookedHash = 0; //Source file and its material libraries, keys the cooked file
+	bool valid = false;
+	std::vector<MeshData> meshes;
+	std::vector<std::string> materialLibraries;
+	std::shared_ptr<MappedFile> cookedFile; //Keeps mapped mesh arrays alive until upload
+};
+
+//What happens to a model's CPU vertex/index arrays once they are on the GPU.
+//Applied by the Model that uploads the geometry, Models sharing it get the same arrays.
+enum class CpuGeometryPolicy
+{
+	Release,		//Upload straight from the import arrays and free them
+	Keep,			//Keep every mesh's arrays (CPU collision, culling, picking)
+	KeepSelected	//Keep only the meshes listed in Model::keepCpuMeshes
+};
 
 class Model
 {
 public:
-	Model(char* path)
+	//Empty model, filled in later by Upload (see ModelLoader)
+	Model()
+	{
+	}
+	Model(char* path, VertexFormat format = VertexFormat::Full, CpuGeometryPolicy policy = CpuGeometryPolicy::Release)
+	{
+		vertexFormat = format;
+		cpuGeometry = policy;
+		ModelData data;
+		if (ReadSource(path, data) && !GeometryRegistry::Get().Contains(GeometryKey(data.contentHash, vertexFormat)))
+			ImportGeometry(data);
+		Upload(std::move(data));
+	}
+	//Textures stay in TextureCache for other Models until Trim evicts them
+	~Model()
+	{
+		for (unsigned int i = 0; i < textures_loaded.size(); i++)
+		{
+			if (textures_loaded[i].type != "texture_virtual")
+				TextureCache::Get().Release(textures_loaded[i].id);
+		}
+	}
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	void Draw(const Shader& shader)
 	{
-			loadModel(path);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader);
 	}
-	void Draw(Shader shader)
+
+	//Draws every mesh with the variant its textures need, setting model on each variant used
+	void Draw(ShaderPermutations& permutations, const glm::mat4& model)
 	{
+		const Shader* current = nullptr;
 		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const Shader& shader = permutations.Get(meshes[i].shaderFeatures);
+			if (&shader != current)
+			{
+				current = &shader;
+				shader.use();
+				shader.setMat4("model"_u, model);
+			}
 			meshes[i].Draw(shader);
+		}
+	}
+
+	//Queues a packet per mesh for RenderQueue::Execute, drawn with shader and model
+	//Models outside the queue's frustum are dropped with one sphere test, the queue tests the
+	//meshes of the rest
+	void Submit(RenderQueue& queue, const Shader& shader, const glm::mat4& model, RenderPass pass = RenderPass::Opaque)
+	{
+		if (!queue.GetFrustum().IntersectsSphere(boundsCenter, boundsRadius, model))
+		{
+			queue.AddCulled((unsigned int)meshes.size());
+			return;
+		}
+		unsigned int transform = queue.AddTransform(model);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			queue.Submit(pass, shader, meshes[i], transform);
+	}
+
+	//As above, each mesh with the variant its textures need
+	void Submit(RenderQueue& queue, ShaderPermutations& permutations, const glm::mat4& model, RenderPass pass = RenderPass::Opaque)
+	{
+		if (!queue.GetFrustum().IntersectsSphere(boundsCenter, boundsRadius, model))
+		{
+			queue.AddCulled((unsigned int)meshes.size());
+			return;
+		}
+		unsigned int transform = queue.AddTransform(model);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			queue.Submit(pass, permutations.Get(meshes[i].shaderFeatures), meshes[i], transform);
+	}
+
+	//Submits the variants Draw will need, so they compile together instead of at first draw
+	void PrepareShaders(ShaderPermutations& permutations) const
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			permutations.Prepare(meshes[i].shaderFeatures);
 	}
 
 	std::vector<Mesh> meshes;
+	//Object space bounds of every mesh together, set by Upload
+	glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
 	std::string directory;
 	std::vector<Texture> textures_loaded;
+	std::shared_ptr<ModelGeometry> geometry;
+	VertexFormat vertexFormat = VertexFormat::Full; //Used by the next Upload
+	CpuGeometryPolicy cpuGeometry = CpuGeometryPolicy::Release;
+	std::vector<unsigned int> keepCpuMeshes; //Mesh indices kept by CpuGeometryPolicy::KeepSelected
+	bool virtualTexturing = false; //Diffuse maps become virtual textures and other maps are skipped, draw with Shaders/VirtualTexture.fs
+	//Permutation features the model is drawn with (ShaderPermutations::GetSupported), maps only
+	//other features would sample are not loaded. Used by the next Upload.
+	uint32_t shaderFeatures = SHADER_SPECULAR_MAP | SHADER_NORMAL_MAP | SHADER_HEIGHT_MAP;
 
-private:
+	//Registry key: the same source uploaded in another vertex format is separate geometry
+	static uint64_t GeometryKey(uint64_t contentHash, VertexFormat format)
+	{
+		return contentHash + (uint64_t)format * 0x9E3779B97F4A7C15ULL;
+	}
 
+	//Maps the source file and records its content hash and material libraries (thread safe)
+	static bool ReadSource(const std::string& path, ModelData& data)
+	{
+		data.path = path;
+		MappedFile source;
+		if (!source.Open(path))
+		{
+			std::cout << "ERROR::MODEL::Failed to open " << path << std::endl;
+			return false;
+		}
+		data.contentHash = MeshCache::Hash(source.GetData(), source.GetSize());
+		data.materialLibraries = MaterialLibrary::FindLibraries(reinterpret_cast<const char*>(source.GetData()), source.GetSize());
+
+		//Cooked meshes carry the textures their materials name, so an edited .mtl must not reuse
+		//them. Shared geometry is keyed by the source alone, loadShared reads each Model's own .mtl.
+		data.cookedHash = data.contentHash;
+		size_t slash = path.find_last_of('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		for (unsigned int i = 0; i < data.materialLibraries.size(); i++)
+		{
+			uint64_t libraryHash = 0;
+			if (MeshCache::HashFile(directory + '/' + data.materialLibraries[i], libraryHash))
+				data.cookedHash = MeshCache::Hash(&libraryHash, sizeof(libraryHash), data.cookedHash);
+		}
+		data.valid = true;
+		return true;
+	}
+
+	//Fills data.meshes from the cooked cache or, failing that, ObjParser for .obj files and
+	//Assimp for everything else (thread safe)
+	static bool ImportGeometry(ModelData& data)
+	{
+		std::string cookedPath = MeshCache::CookedPath(data.path);
+		data.cookedFile = std::make_shared<MappedFile>();
+		if (MeshCache::Load(cookedPath, data.cookedHash, *data.cookedFile, data.meshes))
+			return true;
+		data.cookedFile = nullptr;
+
+		if (!(ObjParser::IsObj(data.path) && ImportObj(data.path, data.materialLibraries, data.meshes)) &&
+			!ImportAssimp(data.path, data.meshes))
+		{
+			data.valid = false;
+			return false;
+		}
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			std::string name = data.path + " mesh " + std::to_string(i);
+			MeshOptimizer::Optimize(data.meshes[i], name);
+			MeshSimplifier::BuildLods(data.meshes[i], name);
+		}
+
+		MeshCache::Save(cookedPath, data.cookedHash, data.meshes);
+		return true;
+	}
 
-	void loadModel(std::string path)
+	//Wavefront fast path, leaves meshes untouched when the file can't be parsed (thread safe)
+	static bool ImportObj(const std::string& path, const std::vector<std::string>& materialLibraries, std::vector<MeshData>& meshes)
+	{
+		MappedFile source;
+		if (!source.Open(path))
+			return false;
+		return ObjParser::Parse(path, reinterpret_cast<const char*>(source.GetData()), source.GetSize(), materialLibraries, meshes);
+	}
+
+	//Any format Assimp reads (thread safe)
+	static bool ImportAssimp(const std::string& path, std::vector<MeshData>& meshes)
 	{
 		Assimp::Importer import;
 		const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals);
 
-		if (!scene || scene->mFlags && AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 		{
 			std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+			return false;
+		}
+		processNode(scene->mRootNode, scene, meshes);
+		return true;
+	}
+
+	//GL thread: uploads the imported geometry, or binds to an identical already uploaded copy,
+	//and loads this model's textures. The import arrays are moved from or freed.
+	void Upload(ModelData&& data)
+	{
+		directory = data.path.substr(0, data.path.find_last_of('/'));
+		if (!data.valid)
+			return;
+
+		//Identical geometry already loaded by another Model
+		uint64_t key = GeometryKey(data.contentHash, vertexFormat);
+		geometry = GeometryRegistry::Get().Find(key);
+		if (geometry)
+		{
+			loadShared();
+			return;
+		}
+		//Skipped by the import as shared, but the last Model using it has gone since
+		if (data.meshes.empty() && !data.cookedFile)
+			ImportGeometry(data);
+		if (data.meshes.empty())
+		{
+			std::cout << "ERROR::MODEL::No geometry imported for " << data.path << std::endl;
+			return;
+		}
+
+		geometry = std::make_shared<ModelGeometry>();
+		geometry->materialLibraries = std::move(data.materialLibraries);
+		meshes.reserve(data.meshes.size());
+		size_t keptBytes = 0;
+		size_t releasedBytes = 0;
+		unsigned int keptMeshes = 0;
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			MeshData& mesh = data.meshes[i];
+			std::vector<Texture> textures = loadMaterialTextures(mesh.textures);
+
+			size_t meshBytes = mesh.vertexCount * sizeof(Vertex) + mesh.indexCount * sizeof(unsigned int);
+			std::shared_ptr<MeshGeometry> meshGeometry;
+			if (keepsCpuGeometry(i))
+			{
+				//Cooked meshes only exist in the mapping, which is closed after upload
+				if (mesh.mappedVertices)
+				{
+					mesh.vertices.assign(mesh.mappedVertices, mesh.mappedVertices + mesh.vertexCount);
+					mesh.indices.assign(mesh.mappedIndices, mesh.mappedIndices + mesh.indexCount);
+				}
+				meshGeometry = std::make_shared<MeshGeometry>(std::move(mesh.vertices), std::move(mesh.indices), vertexFormat);
+				keptBytes += meshBytes;
+				keptMeshes++;
+			}
+			else
+			{
+				//Uploaded straight from the import arrays or the cooked mapping, no CPU copy is made
+				meshGeometry = std::make_shared<MeshGeometry>(mesh.GetVertices(), mesh.vertexCount, mesh.GetIndices(), mesh.indexCount, vertexFormat);
+				releasedBytes += meshBytes;
+			}
+			if (!mesh.lods.empty())
+				meshGeometry->lods = std::move(mesh.lods);
+			meshes.push_back(Mesh(meshGeometry, std::move(textures)));
+
+			geometry->meshes.push_back(meshes.back().geometry);
+			geometry->materials.push_back(std::move(mesh.material));
+		}
+		GeometryRegistry::Get().Add(key, geometry);
+		computeBounds();
+
+		std::vector<MeshData>().swap(data.meshes);
+		data.cookedFile = nullptr;
+		std::cout << data.path << ": CPU geometry kept for " << keptMeshes << "/" << meshes.size() << " meshes ("
+			<< keptBytes / 1024 << " KB), " << releasedBytes / 1024 << " KB released after upload" << std::endl;
+	}
+
+	//Per frame view used by SelectLod. fovY in radians, viewportHeight in pixels.
+	static void SetLodView(const glm::vec3& viewPos, float fovY, float viewportHeight)
+	{
+		LodView& view = lodView();
+		view.position = viewPos;
+		view.pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+	}
+
+	//Picks each mesh's level from the on-screen size of its simplification error when drawn with
+	//the model matrix, using the view from SetLodView
+	void SelectLod(const glm::mat4& model)
+	{
+		const LodView& view = lodView();
+		float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const MeshGeometry& mesh = *meshes[i].geometry;
+			glm::vec3 center = glm::vec3(model * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+			float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * scale;
+			float distance = std::max(glm::length(center - view.position) - radius, 0.1f);
+			meshes[i].lod = chooseLod(mesh.lods, meshes[i].lod, scale * view.pixelsPerUnit / distance);
+		}
+	}
+
+	//Triangles drawn at the currently selected levels
+	unsigned int GetTriangleCount() const
+	{
+		unsigned int triangles = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			triangles += meshes[i].geometry->lods[meshes[i].lod].indexCount / 3;
+		return triangles;
+	}
+
+	//Drops the CPU arrays of every mesh, e.g. once collision data has been built from them
+	size_t ReleaseCpuGeometry()
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].geometry->ReleaseCpuData();
+		return bytes;
+	}
+
+private:
+	std::unordered_set<unsigned int> loadedTextureIds;
+
+	struct LodView
+	{
+		glm::vec3 position = glm::vec3(0.0f);
+		float pixelsPerUnit = 0.0f;
+	};
+
+	static LodView& lodView()
+	{
+		static LodView view;
+		return view;
+	}
+
+	//Coarsest level whose error covers less than a pixel. Switching to a coarser level needs a
+	//margin below that, so a body sitting on the boundary doesn't pop back and forth.
+	static unsigned int chooseLod(const std::vector<MeshLod>& lods, unsigned int current, float pixelsPerUnit)
+	{
+		const float maxPixelError = 1.0f;
+		const float coarsenMargin = 0.75f;
+
+		unsigned int desired = 0;
+		for (unsigned int i = (unsigned int)lods.size() - 1; i > 0; i--)
+		{
+			if (lods[i].error * pixelsPerUnit <= maxPixelError)
+			{
+				desired = i;
+				break;
+			}
+		}
+		if (desired <= current || current >= lods.size())
+			return desired;
+
+		for (unsigned int i = desired; i > current; i--)
+		{
+			if (lods[i].error * pixelsPerUnit <= maxPixelError * coarsenMargin)
+				return i;
+		}
+		return current;
+	}
+
+	bool keepsCpuGeometry(unsigned int mesh) const
+	{
+		if (cpuGeometry == CpuGeometryPolicy::Keep)
+			return true;
+		if (cpuGeometry == CpuGeometryPolicy::KeepSelected)
+			return std::find(keepCpuMeshes.begin(), keepCpuMeshes.end(), mesh) != keepCpuMeshes.end();
+		return false;
+	}
+
+	//Binds this model's own materials to geometry shared with another Model
+	void loadShared()
+	{
+		MaterialLibrary library;
+		for (unsigned int i = 0; i < geometry->materialLibraries.size(); i++)
+			library.Load(directory + '/' + geometry->materialLibraries[i]);
+
+		for (unsigned int i = 0; i < geometry->meshes.size(); i++)
+		{
+			std::vector<Texture> textures;
+			std::map<std::string, std::vector<TextureRef>>::const_iterator material = library.materials.find(geometry->materials[i]);
+			if (material != library.materials.end())
+				textures = loadMaterialTextures(material->second);
+			meshes.push_back(Mesh(geometry->meshes[i], std::move(textures)));
+		}
+		computeBounds();
+	}
+
+	//Box around the mesh boxes, and the sphere around its center holding every mesh sphere
+	void computeBounds()
+	{
+		if (meshes.empty())
 			return;
+		boundsMin = meshes[0].geometry->boundsMin;
+		boundsMax = meshes[0].geometry->boundsMax;
+		for (unsigned int i = 1; i < meshes.size(); i++)
+		{
+			boundsMin = glm::min(boundsMin, meshes[i].geometry->boundsMin);
+			boundsMax = glm::max(boundsMax, meshes[i].geometry->boundsMax);
+		}
+		boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		boundsRadius = 0.0f;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const MeshGeometry& mesh = *meshes[i].geometry;
+			boundsRadius = std::max(boundsRadius, glm::length(mesh.boundsCenter - boundsCenter) + mesh.boundsRadius);
 		}
-		directory = path.substr(0, path.find_last_of('/'));
-		processNode(scene->mRootNode, scene);
 	}
 
-	void processNode(aiNode* node, const aiScene* scene)
+	static void processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshes)
 	{
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
@@ -58,15 +450,15 @@ private:
 		}
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, meshes);
 		}
 	}
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
 	{
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<Texture> textures;
+		MeshData data;
+		std::vector<Vertex>& vertices = data.vertices;
+		std::vector<unsigned int>& indices = data.indices;
 
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
@@ -106,99 +498,105 @@ private:
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
 		}
-		if (mesh->mMaterialIndex >= 0)
-		{
-			aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-			//Diffuse Maps
-			std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+		data.vertexCount = (unsigned int)vertices.size();
+		data.indexCount = (unsigned int)indices.size();
 
-			//Specular Maps
-			std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		aiString materialName;
+		material->Get(AI_MATKEY_NAME, materialName);
+		data.material = materialName.C_Str();
 
-			//Normal Maps
-			std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-			textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+		//Diffuse Maps
+		loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
 
-			//Height Maps
-			std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-			textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+		//Specular Maps
+		loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
 
-			return Mesh(vertices, indices, textures);
-		}
+		//Normal Maps
+		loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
+
+		//Height Maps
+		loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
+
+		return data;
 	}
 
-	std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+	static void loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, std::vector<TextureRef>& textures)
 	{
-		std::vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true;
-					break;
-				}
-			}
+			TextureRef ref;
+			ref.type = typeName;
+			ref.path = str.C_Str();
+			textures.push_back(ref);
+		}
+	}
 
-			if(!skip)
-			{
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);
-			}
+	//The maps of one material a permutation in shaderFeatures can sample. A bump map that is the
+	//diffuse image is skipped too: several .mtl files point map_Bump at the colour map, which
+	//would be decoded again and compressed as a (meaningless) normal map.
+	std::vector<Texture> loadMaterialTextures(const std::vector<TextureRef>& refs)
+	{
+		std::string diffuse;
+		for (unsigned int t = 0; t < refs.size(); t++)
+		{
+			if (refs[t].type == "texture_diffuse")
+				diffuse = refs[t].path;
+		}
+
+		std::vector<Texture> textures;
+		for (unsigned int t = 0; t < refs.size(); t++)
+		{
+			//Shaders/VirtualTexture.fs only samples the virtual diffuse map, anything else would be
+			//a full resolution texture next to the fixed size atlas
+			const TextureRef& ref = refs[t];
+			if (virtualTexturing && ref.type != "texture_diffuse")
+				continue;
+			if (ref.type == "texture_specular" && !(shaderFeatures & SHADER_SPECULAR_MAP))
+				continue;
+			if (ref.type == "texture_normal" && (!(shaderFeatures & SHADER_NORMAL_MAP) || ref.path == diffuse))
+				continue;
+			if (ref.type == "texture_height" && !(shaderFeatures & SHADER_HEIGHT_MAP))
+				continue;
+			textures.push_back(loadTexture(ref.path.c_str(), ref.type));
 		}
 		return textures;
 	}
+
+	//TextureCache dedupes across every Model, textures_loaded keeps one reference per texture
+	Texture loadTexture(const char* path, const std::string& typeName)
+	{
+		Texture texture;
+		if (virtualTexturing && typeName == "texture_diffuse")
+		{
+			//Ids are VirtualTextureSystem's, not GL names
+			texture.id = VirtualTextureSystem::Get().Acquire(directory + '/' + path);
+			texture.type = "texture_virtual";
+			texture.path = path;
+			textures_loaded.push_back(texture);
+			return texture;
+		}
+
+		texture.id = TextureFromFile(path, directory, typeName == "texture_normal" ? TextureUsage::Normal : TextureUsage::Color);
+		texture.type = typeName;
+		texture.path = path;
+		if (loadedTextureIds.insert(texture.id).second)
+			textures_loaded.push_back(texture);
+		else
+			TextureCache::Get().Release(texture.id);
+		return texture;
+	}
 };
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma)
+inline unsigned int TextureFromFile(const char* path, const std::string& directory, TextureUsage usage)
 {
 	std::string filename = std::string(path);
 	filename = directory + '/' + filename;
 	std::cout << filename << std::endl;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-
-	unsigned char* data = stbi_load(filename.c_str() , &width, &height, &nrComponents, 0);
-
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Failed to load texture in model" << std::endl;
-		stbi_image_free(data);
-	}
-	return textureID;
-}
\ No newline at end of file
+	//Decoded and uploaded in the background, draws use a placeholder until it is resident.
+	//Already requested (by path or by identical contents) returns the same texture.
+	return TextureCache::Get().Acquire(filename, false, usage);
+}
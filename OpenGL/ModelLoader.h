@@ -0,0 +1,125 @@
+#pragma once
+#include "Model.h"
+#include "ThreadPool.h"
+#include "LockFreeQueue.h"
+
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+//Imports models on a ThreadPool and uploads them on the GL thread.
+//OBJ/Assimp parsing, vertex conversion and cooked cache reads run on the workers; finished
+//imports are pushed to a lock-free queue that Update drains to do the GL work.
+class ModelLoader
+{
+public:
+	explicit ModelLoader(ThreadPool& pool) : _pool(pool), _pending(0)
+	{
+	}
+
+	~ModelLoader()
+	{
+		WaitAll();
+	}
+
+	ModelLoader(const ModelLoader&) = delete;
+	ModelLoader& operator=(const ModelLoader&) = delete;
+
+	//Queues path for import into model. model must outlive the load.
+	void Load(Model& model, const std::string& path, VertexFormat format = VertexFormat::Full, CpuGeometryPolicy policy = CpuGeometryPolicy::Release)
+	{
+		model.vertexFormat = format;
+		model.cpuGeometry = policy;
+		ImportJob* job = new ImportJob();
+		job->model = &model;
+		job->data.path = path;
+		_pending++;
+		_pool.Submit([this, job] { import(job); });
+	}
+
+	//GL thread: uploads up to maxUploads finished imports, returns how many are still pending
+	unsigned int Update(unsigned int maxUploads = 0xFFFFFFFF)
+	{
+		ImportJob* job = nullptr;
+		for (unsigned int i = 0; i < maxUploads && _completed.TryPop(job); i++)
+		{
+			job->model->Upload(std::move(job->data));
+			delete job;
+			_pending--;
+		}
+		return _pending;
+	}
+
+	//GL thread: blocks until every queued model has been uploaded
+	void WaitAll()
+	{
+		while (Update() > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	unsigned int GetPending() const { return _pending; }
+
+private:
+	struct ImportJob
+	{
+		Model* model;
+		ModelData data;
+	};
+
+	ThreadPool& _pool;
+	LockFreeQueue<ImportJob*> _completed;
+	unsigned int _pending; //Only touched on the GL thread
+
+	//Geometry keys currently being imported, with the jobs waiting on them
+	std::unordered_map<uint64_t, std::vector<ImportJob*>> _inFlight;
+	std::mutex _inFlightMutex;
+
+	//Worker thread
+	void import(ImportJob* job)
+	{
+		if (!Model::ReadSource(job->data.path, job->data))
+		{
+			_completed.Push(job);
+			return;
+		}
+
+		//Already uploaded for another Model, Upload binds to it
+		uint64_t hash = Model::GeometryKey(job->data.contentHash, job->model->vertexFormat);
+		if (GeometryRegistry::Get().Contains(hash))
+		{
+			_completed.Push(job);
+			return;
+		}
+
+		//Identical files are parsed once, the other jobs bind to the uploaded geometry
+		{
+			std::lock_guard<std::mutex> lock(_inFlightMutex);
+			std::unordered_map<uint64_t, std::vector<ImportJob*>>::iterator it = _inFlight.find(hash);
+			if (it != _inFlight.end())
+			{
+				it->second.push_back(job);
+				return;
+			}
+			_inFlight[hash];
+		}
+
+		Model::ImportGeometry(job->data);
+
+		std::vector<ImportJob*> waiting;
+		{
+			std::lock_guard<std::mutex> lock(_inFlightMutex);
+			waiting.swap(_inFlight[hash]);
+			_inFlight.erase(hash);
+		}
+
+		//Pushed first so it is uploaded and registered before the jobs sharing it.
+		//job belongs to the GL thread once pushed.
+		bool valid = job->data.valid;
+		_completed.Push(job);
+		for (unsigned int i = 0; i < waiting.size(); i++)
+		{
+			waiting[i]->data.valid = valid;
+			_completed.Push(waiting[i]);
+		}
+	}
+};
@@ -0,0 +1,741 @@
+#include "ObjParser.h"
+#include "MaterialLibrary.h"
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+#include "Model.h"
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cctype>
+#include <iostream>
+#include <iomanip>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OBJ_PARSER_SSE
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace
+{
+	//Chunks smaller than this are not worth a thread
+	const size_t MIN_CHUNK_BYTES = 128 * 1024;
+
+	//Face indices while chunks are parsed. Positive .obj indices are already global, negative ones
+	//are relative to what the chunk has read so far and get the chunk's offset added once every
+	//chunk is done.
+	const int NO_INDEX = -1;
+	const int RELATIVE_INDEX = 1 << 30;
+
+	struct Corner
+	{
+		int position, texCoord, normal;
+
+		bool operator==(const Corner& other) const
+		{
+			return position == other.position && texCoord == other.texCoord && normal == other.normal;
+		}
+	};
+
+	struct CornerHasher
+	{
+		size_t operator()(const Corner& corner) const
+		{
+			uint64_t hash = (uint64_t)(uint32_t)corner.position * 0x9E3779B97F4A7C15ULL;
+			hash ^= (uint64_t)(uint32_t)corner.texCoord * 0xC2B2AE3D27D4EB4FULL;
+			hash ^= (uint64_t)(uint32_t)corner.normal * 0x165667B19E3779F9ULL;
+			return (size_t)(hash ^ (hash >> 29));
+		}
+	};
+
+	//Run of triangles sharing an object and material. Every chunk starts with one that inherits
+	//both from wherever the previous chunk ended.
+	struct Section
+	{
+		std::string object, material;
+		bool objectSet, materialSet;
+		size_t firstCorner;
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texCoords;
+		std::vector<Corner> corners; //3 per triangle
+		std::vector<Section> sections;
+		size_t positionOffset, texCoordOffset, normalOffset; //Global index of the chunk's first element
+		unsigned int errorLine; //Line within the chunk that failed to parse, 0 when it parsed
+	};
+
+	//Triangles of one output mesh, gathered from every chunk
+	struct MeshBuild
+	{
+		std::string object, material;
+		std::vector<std::pair<const Corner*, const Corner*>> ranges;
+		size_t cornerCount;
+	};
+
+	//Runs task(thread) on threadCount threads, the calling thread being thread 0. Plain threads
+	//rather than ThreadPool: imports already run on the pool, and waiting there on tasks queued
+	//behind other imports could deadlock.
+	template <typename Task>
+	void RunParallel(size_t threadCount, const Task& task)
+	{
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < threadCount; i++)
+			threads.push_back(std::thread([&task, i] { task(i); }));
+		task(0);
+		for (unsigned int i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+#ifdef OBJ_PARSER_SSE
+	unsigned int CountTrailingZeros(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+#endif
+
+	//First '\n' at or after p, or end. 16 bytes per compare.
+	const char* FindLineEnd(const char* p, const char* end)
+	{
+#ifdef OBJ_PARSER_SSE
+		const __m128i newline = _mm_set1_epi8('\n');
+		for (; end - p >= 16; p += 16)
+		{
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+			if (mask)
+				return p + CountTrailingZeros(mask);
+		}
+#endif
+		while (p < end && *p != '\n')
+			p++;
+		return p;
+	}
+
+	const char* SkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	std::string Trimmed(const char* p, const char* end)
+	{
+		p = SkipSpaces(p, end);
+		while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		return std::string(p, end);
+	}
+
+	//SWAR digit parsing on 8 little endian bytes (Lemire, "Fast number parsing, SWAR")
+	bool IsEightDigits(uint64_t bytes)
+	{
+		return (((bytes & 0xF0F0F0F0F0F0F0F0ULL) | (((bytes + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+	}
+
+	uint32_t ParseEightDigits(uint64_t bytes)
+	{
+		const uint64_t mask = 0x000000FF000000FFULL;
+		const uint64_t mul1 = 100 + (1000000ULL << 32);
+		const uint64_t mul2 = 1 + (10000ULL << 32);
+		bytes -= 0x3030303030303030ULL;
+		bytes = (bytes * 10) + (bytes >> 8);
+		return (uint32_t)((((bytes & mask) * mul1) + (((bytes >> 16) & mask) * mul2)) >> 32);
+	}
+
+	//Appends the digits at p to mantissa. Past the 19 digits a uint64 holds, integer digits only
+	//move the exponent and fraction digits are dropped.
+	const char* ParseDigits(const char* p, const char* end, uint64_t& mantissa, int& digits, int& exponent, bool fraction)
+	{
+		while (digits <= 11 && end - p >= 8)
+		{
+			uint64_t bytes;
+			std::memcpy(&bytes, p, 8);
+			if (!IsEightDigits(bytes))
+				break;
+			mantissa = mantissa * 100000000 + ParseEightDigits(bytes);
+			digits += 8;
+			if (fraction)
+				exponent -= 8;
+			p += 8;
+		}
+		for (; p < end && (unsigned char)(*p - '0') < 10; p++)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits++;
+				if (fraction)
+					exponent--;
+			}
+			else if (!fraction)
+			{
+				exponent++;
+			}
+		}
+		return p;
+	}
+
+	const char* ParseIndex(const char* p, const char* end, int& value)
+	{
+		bool negative = p < end && *p == '-';
+		if (negative)
+			p++;
+		const char* start = p;
+		int parsed = 0;
+		for (; p < end && (unsigned char)(*p - '0') < 10; p++)
+			parsed = parsed * 10 + (*p - '0');
+		if (p == start || p - start > 9)
+			return nullptr;
+		value = negative ? -parsed : parsed;
+		return p;
+	}
+
+	//count is how many elements of the kind the chunk had read when it reached the face
+	bool EncodeIndex(int index, size_t count, int& encoded)
+	{
+		if (index > 0 && index < RELATIVE_INDEX / 2)
+		{
+			encoded = index - 1;
+			return true;
+		}
+		if (index < 0 && (long long)count + index > -(long long)(RELATIVE_INDEX / 2))
+		{
+			encoded = RELATIVE_INDEX + (int)count + index;
+			return true;
+		}
+		return false;
+	}
+
+	bool ResolveIndex(int& index, size_t offset, size_t count)
+	{
+		if (index == NO_INDEX)
+			return true;
+		long long global = index >= RELATIVE_INDEX / 2 ? (long long)index - RELATIVE_INDEX + (long long)offset : index;
+		if (global < 0 || global >= (long long)count)
+			return false;
+		index = (int)global;
+		return true;
+	}
+
+	//v, v/t, v//n or v/t/n
+	const char* ParseCorner(const char* p, const char* end, const Chunk& chunk, Corner& corner)
+	{
+		int index;
+		corner.texCoord = NO_INDEX;
+		corner.normal = NO_INDEX;
+		p = ParseIndex(p, end, index);
+		if (!p || !EncodeIndex(index, chunk.positions.size(), corner.position))
+			return nullptr;
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/')
+			{
+				p = ParseIndex(p, end, index);
+				if (!p || !EncodeIndex(index, chunk.texCoords.size(), corner.texCoord))
+					return nullptr;
+			}
+			if (p < end && *p == '/')
+			{
+				p = ParseIndex(p + 1, end, index);
+				if (!p || !EncodeIndex(index, chunk.normals.size(), corner.normal))
+					return nullptr;
+			}
+		}
+		if (p < end && *p != ' ' && *p != '\t')
+			return nullptr;
+		return p;
+	}
+
+	void StartSection(Chunk& chunk, const std::string* object, const std::string* material)
+	{
+		Section section = chunk.sections.back();
+		section.firstCorner = chunk.corners.size();
+		if (object)
+		{
+			section.object = *object;
+			section.objectSet = true;
+		}
+		if (material)
+		{
+			section.material = *material;
+			section.materialSet = true;
+		}
+		//Nothing was drawn with the current one
+		if (chunk.sections.back().firstCorner == chunk.corners.size())
+			chunk.sections.back() = section;
+		else
+			chunk.sections.push_back(section);
+	}
+
+	bool ParseLine(Chunk& chunk, const char* p, const char* end, std::vector<Corner>& polygon)
+	{
+		p = SkipSpaces(p, end);
+		const char* keyword = p;
+		while (p < end && *p != ' ' && *p != '\t')
+			p++;
+		size_t length = p - keyword;
+		if (length == 0 || keyword[0] == '#')
+			return true;
+
+		if (keyword[0] == 'v' && (length == 1 || (length == 2 && (keyword[1] == 't' || keyword[1] == 'n'))))
+		{
+			//Extra values (w, vertex colours) are ignored, a texture coordinate needs only u
+			int required = length == 2 && keyword[1] == 't' ? 1 : 3;
+			float values[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 3; i++)
+			{
+				p = SkipSpaces(p, end);
+				if (p == end)
+				{
+					if (i < required)
+						return false;
+					break;
+				}
+				p = ObjParser::ParseFloat(p, end, values[i]);
+				if (!p)
+					return false;
+			}
+			if (length == 1)
+				chunk.positions.push_back(glm::vec3(values[0], values[1], values[2]));
+			else if (keyword[1] == 't')
+				chunk.texCoords.push_back(glm::vec2(values[0], values[1]));
+			else
+				chunk.normals.push_back(glm::vec3(values[0], values[1], values[2]));
+			return true;
+		}
+
+		if (length == 1 && keyword[0] == 'f')
+		{
+			polygon.clear();
+			for (;;)
+			{
+				p = SkipSpaces(p, end);
+				if (p == end)
+					break;
+				Corner corner;
+				p = ParseCorner(p, end, chunk, corner);
+				if (!p)
+					return false;
+				polygon.push_back(corner);
+			}
+			//Fan triangulation, points and lines are dropped like aiProcess_Triangulate leaves them out of triangle meshes
+			for (size_t i = 2; i < polygon.size(); i++)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i - 1]);
+				chunk.corners.push_back(polygon[i]);
+			}
+			return true;
+		}
+
+		if (length == 1 && (keyword[0] == 'o' || keyword[0] == 'g'))
+		{
+			std::string name = Trimmed(p, end);
+			StartSection(chunk, &name, nullptr);
+		}
+		else if (length == 6 && std::memcmp(keyword, "usemtl", 6) == 0)
+		{
+			std::string name = Trimmed(p, end);
+			StartSection(chunk, nullptr, &name);
+		}
+		return true;
+	}
+
+	void ParseChunk(Chunk& chunk)
+	{
+		Section first = { "", "", false, false, 0 };
+		chunk.sections.push_back(first);
+		chunk.errorLine = 0;
+
+		std::vector<Corner> polygon;
+		unsigned int line = 0;
+		const char* p = chunk.begin;
+		while (p < chunk.end)
+		{
+			line++;
+			const char* lineEnd = FindLineEnd(p, chunk.end);
+			const char* next = lineEnd < chunk.end ? lineEnd + 1 : chunk.end;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+				lineEnd--;
+			if (!ParseLine(chunk, p, lineEnd, polygon))
+			{
+				chunk.errorLine = line;
+				return;
+			}
+			p = next;
+		}
+	}
+
+	void BuildMesh(const MeshBuild& build, const std::vector<glm::vec3>& positions, const std::vector<glm::vec2>& texCoords,
+		const std::vector<glm::vec3>& normals, MeshData& mesh)
+	{
+		std::unordered_map<Corner, unsigned int, CornerHasher> welded;
+		welded.reserve(build.cornerCount);
+		mesh.indices.reserve(build.cornerCount);
+
+		for (unsigned int r = 0; r < build.ranges.size(); r++)
+		{
+			for (const Corner* triangle = build.ranges[r].first; triangle < build.ranges[r].second; triangle += 3)
+			{
+				//aiProcess_GenNormals: flat face normals where the file has none
+				glm::vec3 faceNormal(0.0f);
+				if (triangle[0].normal == NO_INDEX || triangle[1].normal == NO_INDEX || triangle[2].normal == NO_INDEX)
+				{
+					glm::vec3 cross = glm::cross(positions[triangle[1].position] - positions[triangle[0].position],
+						positions[triangle[2].position] - positions[triangle[0].position]);
+					float length = glm::length(cross);
+					if (length > 0.0f)
+						faceNormal = cross / length;
+				}
+
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					const Corner& corner = triangle[k];
+					if (corner.normal != NO_INDEX)
+					{
+						std::unordered_map<Corner, unsigned int, CornerHasher>::iterator found = welded.find(corner);
+						if (found != welded.end())
+						{
+							mesh.indices.push_back(found->second);
+							continue;
+						}
+						welded.emplace(corner, (unsigned int)mesh.vertices.size());
+					}
+
+					//aiProcess_FlipUVs
+					Vertex vertex;
+					vertex.Position = positions[corner.position];
+					vertex.Normal = corner.normal != NO_INDEX ? normals[corner.normal] : faceNormal;
+					vertex.TexCoords = corner.texCoord != NO_INDEX ? glm::vec2(texCoords[corner.texCoord].x, 1.0f - texCoords[corner.texCoord].y) : glm::vec2(0.0f);
+					mesh.indices.push_back((unsigned int)mesh.vertices.size());
+					mesh.vertices.push_back(vertex);
+				}
+			}
+		}
+		mesh.vertexCount = (unsigned int)mesh.vertices.size();
+		mesh.indexCount = (unsigned int)mesh.indices.size();
+		mesh.material = build.material;
+	}
+
+	double Milliseconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//Largest difference between the corners of matching triangles, or a negative value when the
+	//meshes don't line up
+	float CompareMeshes(const std::vector<MeshData>& a, const std::vector<MeshData>& b)
+	{
+		if (a.size() != b.size())
+			return -1.0f;
+		float error = 0.0f;
+		for (unsigned int m = 0; m < a.size(); m++)
+		{
+			if (a[m].indexCount != b[m].indexCount)
+				return -1.0f;
+			const Vertex* va = a[m].GetVertices();
+			const Vertex* vb = b[m].GetVertices();
+			const unsigned int* ia = a[m].GetIndices();
+			const unsigned int* ib = b[m].GetIndices();
+			for (unsigned int i = 0; i < a[m].indexCount; i++)
+			{
+				const Vertex& x = va[ia[i]];
+				const Vertex& y = vb[ib[i]];
+				glm::vec3 position = glm::abs(x.Position - y.Position);
+				glm::vec3 normal = glm::abs(x.Normal - y.Normal);
+				glm::vec2 texCoords = glm::abs(x.TexCoords - y.TexCoords);
+				error = std::max(error, std::max(std::max(position.x, std::max(position.y, position.z)), std::max(normal.x, std::max(normal.y, normal.z))));
+				error = std::max(error, std::max(texCoords.x, texCoords.y));
+			}
+		}
+		return error;
+	}
+}
+
+bool ObjParser::IsObj(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || path.size() - dot != 4)
+		return false;
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+	return extension == "obj";
+}
+
+const char* ObjParser::ParseFloat(const char* p, const char* end, float& value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	const char* start = p;
+	p = ParseDigits(p, end, mantissa, digits, exponent, false);
+	bool hasDigits = p != start;
+	if (p < end && *p == '.')
+	{
+		const char* fraction = ++p;
+		p = ParseDigits(p, end, mantissa, digits, exponent, true);
+		hasDigits |= p != fraction;
+	}
+	if (!hasDigits)
+		return nullptr;
+
+	//An 'e' without digits after it is not part of the number
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+		{
+			negativeExponent = *e == '-';
+			e++;
+		}
+		if (e < end && (unsigned char)(*e - '0') < 10)
+		{
+			int parsed = 0;
+			for (; e < end && (unsigned char)(*e - '0') < 10; e++)
+				parsed = std::min(parsed * 10 + (*e - '0'), 1000);
+			exponent += negativeExponent ? -parsed : parsed;
+			p = e;
+		}
+	}
+
+	//Exact for up to 15 digits and |exponent| <= 22, which covers every exporter we have seen
+	double result = (double)mantissa;
+	if (mantissa != 0 && exponent != 0)
+	{
+		if (exponent < 0 && exponent >= -22)
+			result /= powers[-exponent];
+		else if (exponent > 0 && exponent <= 22)
+			result *= powers[exponent];
+		else
+			result *= std::pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+bool ObjParser::Parse(const std::string& path, const char* data, size_t size, const std::vector<std::string>& materialLibraries,
+	std::vector<MeshData>& meshes, unsigned int threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, size / MIN_CHUNK_BYTES));
+
+	//Split at line ends near equal byte offsets
+	std::vector<Chunk> chunks(chunkCount);
+	const char* end = data + size;
+	const char* begin = data;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		chunks[i].begin = begin;
+		const char* split = std::max(begin, data + size * (i + 1) / chunkCount);
+		split = FindLineEnd(split, end);
+		chunks[i].end = split < end ? split + 1 : end;
+		begin = chunks[i].end;
+	}
+
+	RunParallel(chunkCount, [&chunks](size_t i) { ParseChunk(chunks[i]); });
+
+	size_t positionCount = 0;
+	size_t texCoordCount = 0;
+	size_t normalCount = 0;
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		Chunk& chunk = chunks[i];
+		if (chunk.errorLine)
+		{
+			size_t line = std::count(data, chunk.begin, '\n') + chunk.errorLine;
+			std::cout << "ERROR::OBJ::" << path << " line " << line << " could not be parsed" << std::endl;
+			return false;
+		}
+		chunk.positionOffset = positionCount;
+		chunk.texCoordOffset = texCoordCount;
+		chunk.normalOffset = normalCount;
+		positionCount += chunk.positions.size();
+		texCoordCount += chunk.texCoords.size();
+		normalCount += chunk.normals.size();
+	}
+
+	//Global indices, checked against the whole file
+	std::vector<char> resolved(chunkCount, 0);
+	RunParallel(chunkCount, [&](size_t i)
+	{
+		Chunk& chunk = chunks[i];
+		for (unsigned int c = 0; c < chunk.corners.size(); c++)
+		{
+			Corner& corner = chunk.corners[c];
+			if (!ResolveIndex(corner.position, chunk.positionOffset, positionCount) ||
+				!ResolveIndex(corner.texCoord, chunk.texCoordOffset, texCoordCount) ||
+				!ResolveIndex(corner.normal, chunk.normalOffset, normalCount))
+				return;
+		}
+		resolved[i] = 1;
+	});
+	if (std::find(resolved.begin(), resolved.end(), 0) != resolved.end())
+	{
+		std::cout << "ERROR::OBJ::" << path << " has face indices out of range" << std::endl;
+		return false;
+	}
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texCoords;
+	std::vector<glm::vec3> normals;
+	positions.reserve(positionCount);
+	texCoords.reserve(texCoordCount);
+	normals.reserve(normalCount);
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+		texCoords.insert(texCoords.end(), chunks[i].texCoords.begin(), chunks[i].texCoords.end());
+		normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		std::vector<glm::vec3>().swap(chunks[i].positions);
+		std::vector<glm::vec2>().swap(chunks[i].texCoords);
+		std::vector<glm::vec3>().swap(chunks[i].normals);
+	}
+
+	//One mesh per object and material, in order of first use. Unnamed materials get Assimp's default.
+	std::vector<MeshBuild> builds;
+	std::string object;
+	std::string material = "DefaultMaterial";
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		const Chunk& chunk = chunks[i];
+		for (unsigned int s = 0; s < chunk.sections.size(); s++)
+		{
+			const Section& section = chunk.sections[s];
+			if (section.objectSet)
+				object = section.object;
+			if (section.materialSet)
+				material = section.material;
+			size_t last = s + 1 < chunk.sections.size() ? chunk.sections[s + 1].firstCorner : chunk.corners.size();
+			if (last == section.firstCorner)
+				continue;
+
+			unsigned int b = 0;
+			while (b < builds.size() && (builds[b].object != object || builds[b].material != material))
+				b++;
+			if (b == builds.size())
+			{
+				MeshBuild build;
+				build.object = object;
+				build.material = material;
+				build.cornerCount = 0;
+				builds.push_back(build);
+			}
+			builds[b].ranges.push_back(std::make_pair(chunk.corners.data() + section.firstCorner, chunk.corners.data() + last));
+			builds[b].cornerCount += last - section.firstCorner;
+		}
+	}
+
+	MaterialLibrary library;
+	size_t slash = path.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+	for (unsigned int i = 0; i < materialLibraries.size(); i++)
+		library.Load(directory + '/' + materialLibraries[i]);
+
+	std::vector<MeshData> built(builds.size());
+	std::atomic<size_t> next(0);
+	RunParallel(std::min<size_t>(threadCount, builds.size()), [&](size_t)
+	{
+		for (size_t i = next++; i < builds.size(); i = next++)
+			BuildMesh(builds[i], positions, texCoords, normals, built[i]);
+	});
+	for (unsigned int i = 0; i < built.size(); i++)
+	{
+		std::map<std::string, std::vector<TextureRef>>::const_iterator found = library.materials.find(built[i].material);
+		if (found != library.materials.end())
+			built[i].textures = found->second;
+		meshes.push_back(std::move(built[i]));
+	}
+	return true;
+}
+
+bool ObjParser::Benchmark(const std::vector<std::string>& paths, unsigned int repeats)
+{
+	bool matched = true;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "OBJ import benchmark, best of " << repeats << ", " << threads << " hardware threads" << std::endl;
+	for (unsigned int p = 0; p < paths.size(); p++)
+	{
+		const std::string& path = paths[p];
+		double parsedTime = 1e30;
+		double singleTime = 1e30;
+		double assimpTime = 1e30;
+		std::vector<MeshData> parsed, single, imported;
+		for (unsigned int r = 0; r < repeats; r++)
+		{
+			//Mapping and .mtl reading are timed too, Assimp does both inside ReadFile
+			for (unsigned int pass = 0; pass < 2; pass++)
+			{
+				std::vector<MeshData>& meshes = pass == 0 ? parsed : single;
+				meshes.clear();
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				MappedFile source;
+				if (!source.Open(path))
+				{
+					std::cout << "Failed to open " << path << std::endl;
+					return false;
+				}
+				const char* text = reinterpret_cast<const char*>(source.GetData());
+				std::vector<std::string> libraries = MaterialLibrary::FindLibraries(text, source.GetSize());
+				Parse(path, text, source.GetSize(), libraries, meshes, pass == 0 ? 0 : 1);
+				double& best = pass == 0 ? parsedTime : singleTime;
+				best = std::min(best, Milliseconds(start));
+			}
+
+			imported.clear();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			Model::ImportAssimp(path, imported);
+			assimpTime = std::min(assimpTime, Milliseconds(start));
+		}
+
+		size_t triangles = 0;
+		size_t vertices = 0;
+		for (unsigned int i = 0; i < parsed.size(); i++)
+		{
+			triangles += parsed[i].indexCount / 3;
+			vertices += parsed[i].vertexCount;
+		}
+		float error = CompareMeshes(parsed, imported);
+		bool same = error >= 0.0f && error < 1e-4f && CompareMeshes(parsed, single) == 0.0f;
+		matched &= same;
+
+		std::cout << std::fixed << std::setprecision(2) << path << ": " << parsed.size() << " meshes, " << triangles << " triangles, "
+			<< vertices << " vertices | parser " << parsedTime << " ms (1 thread " << singleTime << " ms), Assimp " << assimpTime
+			<< " ms, " << assimpTime / parsedTime << "x | " << (same ? "same geometry" : "GEOMETRY DIFFERS");
+		if (error >= 0.0f)
+			std::cout << std::scientific << std::setprecision(1) << ", max difference " << error;
+		std::cout << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+	}
+	return matched;
+}
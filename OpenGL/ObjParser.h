@@ -0,0 +1,29 @@
+#pragma once
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+
+//Fast import path for Wavefront .obj files, Assimp stays the fallback for everything else.
+//The file is split into chunks at line boundaries and every chunk is parsed on its own thread
+//(SSE2 line scanning, 8 digits at a time float parsing). The chunks are then stitched together
+//and each object/material pair becomes a MeshData with welded Vertex and index arrays, matching
+//what Model::processMesh produces with aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals.
+class ObjParser
+{
+public:
+	static bool IsObj(const std::string& path);
+
+	//Parses the .obj text in data. Texture references come from materialLibraries, loaded from the
+	//directory of path. threadCount 0 picks one thread per hardware thread, small files use fewer.
+	static bool Parse(const std::string& path, const char* data, size_t size, const std::vector<std::string>& materialLibraries,
+		std::vector<MeshData>& meshes, unsigned int threadCount = 0);
+
+	//Times Parse against the Assimp import of each file, checks both give the same geometry and
+	//prints the results. Run with "LoneDestroyer --benchmark-obj".
+	static bool Benchmark(const std::vector<std::string>& paths, unsigned int repeats = 5);
+
+	//Parses a decimal float (sign, digits, fraction, exponent) starting at p, returns the end or
+	//nullptr when there is no number there
+	static const char* ParseFloat(const char* p, const char* end, float& value);
+};
@@ -0,0 +1,118 @@
+#include "RenderQueue.h"
+#include "Mesh.h"
+
+#include <cstring>
+#include <utility>
+
+void RenderQueue::Begin(const glm::vec3& viewPos, const glm::mat4& viewProjection)
+{
+	_viewPos = viewPos;
+	_frustum = Frustum(viewProjection);
+	_culled = 0;
+	_packets.clear();
+	_transforms.clear();
+	_order.clear();
+}
+
+unsigned int RenderQueue::AddTransform(const glm::mat4& model)
+{
+	_transforms.push_back(model);
+	return (unsigned int)_transforms.size() - 1;
+}
+
+void RenderQueue::Submit(RenderPass pass, const Shader& shader, Mesh& mesh, unsigned int transform)
+{
+	const MeshGeometry& geometry = *mesh.geometry;
+	if (!_frustum.IntersectsBox(geometry.boundsMin, geometry.boundsMax, _transforms[transform]))
+	{
+		_culled++;
+		return;
+	}
+
+	//Textures as Draw will bind them, placeholders included
+	unsigned int textureHash = 2166136261u;
+	for (unsigned int i = 0; i < mesh.textures.size(); i++)
+	{
+		unsigned int texture = mesh.textures[i].type == "texture_virtual" ? mesh.textures[i].id : TextureStreamer::Get().Resolve(mesh.textures[i].id);
+		textureHash = (textureHash ^ texture) * 16777619u;
+	}
+
+	glm::vec3 center = glm::vec3(_transforms[transform] * glm::vec4(geometry.boundsCenter, 1.0f));
+	float depth = glm::length(center - _viewPos);
+
+	DrawPacket packet = { &shader, &mesh, transform };
+	SortEntry entry = { MakeKey(pass, shader.ID, textureHash ^ (textureHash >> 16), mesh.VAO, depth), (unsigned int)_packets.size() };
+	_packets.push_back(packet);
+	_order.push_back(entry);
+}
+
+void RenderQueue::Execute()
+{
+	sort();
+
+	const Shader* shader = nullptr;
+	unsigned int transform = 0xFFFFFFFF;
+	_programChanges = 0;
+	for (unsigned int i = 0; i < _order.size(); i++)
+	{
+		const DrawPacket& packet = _packets[_order[i].packet];
+		if (packet.shader != shader)
+		{
+			shader = packet.shader;
+			shader->use();
+			transform = 0xFFFFFFFF;
+			_programChanges++;
+		}
+		if (packet.transform != transform)
+		{
+			transform = packet.transform;
+			shader->setMat4("model"_u, _transforms[transform]);
+		}
+		packet.mesh->Draw(*shader);
+	}
+	_order.clear();
+}
+
+uint64_t RenderQueue::MakeKey(RenderPass pass, unsigned int program, unsigned int textureHash, unsigned int vertexArray, float depth)
+{
+	//Non-negative floats order the same as their bits
+	uint32_t depthBits = 0;
+	if (depth > 0.0f)
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+	depthBits >>= 8;
+	if (pass == RenderPass::Transparent)
+		depthBits = ~depthBits & 0xFFFFFF;
+
+	return ((uint64_t)pass << 62) | ((uint64_t)(program & 0x3FF) << 52) | ((uint64_t)(textureHash & 0xFFFF) << 36) |
+		((uint64_t)(vertexArray & 0xFF) << 24) | depthBits;
+}
+
+//LSD radix sort, 8 bits a pass. Passes where every key has the same digit are skipped, which
+//is most of them with a handful of programs and textures.
+void RenderQueue::sort()
+{
+	size_t count = _order.size();
+	if (count < 2)
+		return;
+	_scratch.resize(count);
+
+	for (unsigned int shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = {};
+		for (size_t i = 0; i < count; i++)
+			histogram[(_order[i].key >> shift) & 0xFF]++;
+		if (histogram[(_order[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		size_t offset = 0;
+		for (unsigned int digit = 0; digit < 256; digit++)
+		{
+			size_t digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+		for (size_t i = 0; i < count; i++)
+			_scratch[histogram[(_order[i].key >> shift) & 0xFF]++] = _order[i];
+		_order.swap(_scratch);
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "Frustum.h"
+
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+class Shader;
+
+//Passes run in this order. Opaque draws front to back, Transparent back to front.
+enum class RenderPass
+{
+	Opaque,
+	Sky,
+	Transparent,
+	Overlay
+};
+
+//Per frame list of mesh draws. Models submit a packet per mesh, Execute sorts them by a packed
+//64 bit key and draws them in one loop, so the order things are declared in no longer decides
+//how often programs, textures and VAOs change, and opaque geometry is drawn near to far.
+//
+//Key, most significant first:
+//	pass		2 bits
+//	program		10 bits
+//	textures	16 bits (hash of the bound texture set)
+//	VAO			8 bits
+//	depth		24 bits (top of the float bits of the view distance, inverted for Transparent)
+class RenderQueue
+{
+public:
+	//Clears the previous frame's packets and counts. Depth is measured from viewPos, meshes
+	//outside the frustum of viewProjection (projection * view) are culled at Submit.
+	void Begin(const glm::vec3& viewPos, const glm::mat4& viewProjection);
+
+	//Transform shared by the packets of one model, set as "model" when Execute reaches them
+	unsigned int AddTransform(const glm::mat4& model);
+
+	//Draws mesh with shader and the transform unless its box is outside the frustum. The mesh and
+	//shader must outlive Execute.
+	void Submit(RenderPass pass, const Shader& shader, Mesh& mesh, unsigned int transform);
+
+	//For meshes rejected before Submit, e.g. a whole model outside the frustum
+	void AddCulled(unsigned int meshes) { _culled += meshes; }
+
+	//Sorts and draws everything submitted since Begin
+	void Execute();
+
+	unsigned int GetPacketCount() const { return (unsigned int)_packets.size(); }
+	unsigned int GetProgramChanges() const { return _programChanges; }
+	const Frustum& GetFrustum() const { return _frustum; }
+
+	//Meshes queued and meshes culled since Begin
+	unsigned int GetVisibleCount() const { return (unsigned int)_packets.size(); }
+	unsigned int GetCulledCount() const { return _culled; }
+
+	static uint64_t MakeKey(RenderPass pass, unsigned int program, unsigned int textureHash, unsigned int vertexArray, float depth);
+
+private:
+	struct DrawPacket
+	{
+		const Shader* shader;
+		Mesh* mesh;
+		unsigned int transform;
+	};
+
+	struct SortEntry
+	{
+		uint64_t key;
+		unsigned int packet;
+	};
+
+	glm::vec3 _viewPos;
+	Frustum _frustum;
+	unsigned int _culled = 0;
+	std::vector<DrawPacket> _packets;
+	std::vector<glm::mat4> _transforms;
+	std::vector<SortEntry> _order;
+	std::vector<SortEntry> _scratch;
+	unsigned int _programChanges = 0;
+
+	void sort();
+};
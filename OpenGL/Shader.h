@@ -1,122 +1,169 @@
 #pragma once
 #include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "FrameUniforms.h"
+#include "GLState.h"
+#include "ShaderCache.h"
+
+#include <cstdint>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <vector>
 #include <iostream>
 
+//32 bit FNV-1a of a uniform name, seed continues a hash ("material." then the rest)
+constexpr uint32_t HashUniformName(const char* name, size_t length, uint32_t seed = 2166136261u)
+{
+	uint32_t hash = seed;
+	for (size_t i = 0; i < length; i++)
+		hash = (uint32_t)((uint64_t)(hash ^ (unsigned char)name[i]) * 16777619u);
+	return hash;
+}
+
+//Hashed uniform name. "view"_u is a constant expression, so call sites carry no strings.
+struct UniformId
+{
+	uint32_t hash;
+};
+
+constexpr UniformId operator"" _u(const char* name, size_t length)
+{
+	return UniformId{ HashUniformName(name, length) };
+}
+
 class Shader
 {
 public:
 	GLuint ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath)
+	//Programs come from ShaderCache: one per distinct source and define set, loaded from a
+	//program binary when the driver kept one. Construction only submits the compile, so build
+	//every Shader up front; the driver is asked for the result when the Shader is first used.
+	Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines = {})
 	{
-		//Stores code from the file
-		std::string vertexCode;
-		std::string fragmentCode;
-
-		//The files
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-
-		//Exceptions
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-		try
-		{
-			vShaderFile.open(vertexPath); //Opens the vertex shader (.vs)
-			fShaderFile.open(fragmentPath); //Opens the fragment shader (.fs)
-			std::stringstream vShaderStream, fShaderStream;
-
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
+		ID = ShaderCache::Get().Acquire(vertexPath, fragmentPath, defines);
+	}
 
-			vShaderFile.close();
-			fShaderFile.close();
+	void use() const
+	{
+		if (!_resolved)
+			resolve();
+		GLState::Get().UseProgram(ID);
+	}
 
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-		}
-		catch (std::ifstream::failure e)
+	//Location from the table built at link, -1 for names that are not active uniforms (like glGetUniformLocation)
+	GLint getLocation(UniformId id) const
+	{
+		if (!_resolved)
+			resolve();
+		if (_uniforms.empty())
+			return -1;
+		for (uint32_t i = id.hash & _uniformMask;; i = (i + 1) & _uniformMask)
 		{
-			std::cout << "Shader file read failed" << std::endl;
+			if (_uniforms[i].location == EMPTY_SLOT)
+				return -1;
+			if (_uniforms[i].hash == id.hash)
+				return _uniforms[i].location;
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char* fShaderCode = fragmentCode.c_str();
-
-		//Compile Vertex and Fragment
-		GLuint vertex, fragment;
-		int success;
-		char infoLog[512];
+	}
+	GLint getLocation(const std::string& name) const { return getLocation(UniformId{ HashUniformName(name.c_str(), name.size()) }); }
+
+	//Uniform Setters. Take "name"_u, a location from getLocation, or a runtime built name.
+	void setBool(GLint location, bool value) const { glUniform1i(location, (int)value); }
+	void setInt(GLint location, int value) const { glUniform1i(location, value); }
+	void setFloat(GLint location, float value) const { glUniform1f(location, value); }
+	void setVec2(GLint location, const glm::vec2& value) const { glUniform2f(location, value.x, value.y); }
+	void setVec3(GLint location, const glm::vec3& value) const { glUniform3f(location, value.x, value.y, value.z); }
+	void setMat4(GLint location, const glm::mat4& value) const { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+	void setBool(UniformId id, bool value) const { setBool(getLocation(id), value); }
+	void setInt(UniformId id, int value) const { setInt(getLocation(id), value); }
+	void setFloat(UniformId id, float value) const { setFloat(getLocation(id), value); }
+	void setVec2(UniformId id, const glm::vec2& value) const { setVec2(getLocation(id), value); }
+	void setVec3(UniformId id, const glm::vec3& value) const { setVec3(getLocation(id), value); }
+	void setMat4(UniformId id, const glm::mat4& value) const { setMat4(getLocation(id), value); }
+
+	void setBool(const std::string& name, bool value) const { setBool(getLocation(name), value); }
+	void setInt(const std::string& name, int value) const { setInt(getLocation(name), value); }
+	void setFloat(const std::string& name, float value) const { setFloat(getLocation(name), value); }
+	void setVec2(const std::string& name, const glm::vec2& value) const { setVec2(getLocation(name), value); }
+	void setVec3(const std::string& name, const glm::vec3& value) const { setVec3(getLocation(name), value); }
+	void setMat4(const std::string& name, const glm::mat4& value) const { setMat4(getLocation(name), value); }
+
+private:
+	static const GLint EMPTY_SLOT = -2;
+
+	struct UniformSlot
+	{
+		uint32_t hash;
+		GLint location;
+	};
 
-		//Compile Vertex
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
+	//Open addressed, at most half full, so a lookup is a probe or two and never reaches the driver.
+	//Filled on first use, once the program has linked.
+	mutable std::vector<UniformSlot> _uniforms;
+	mutable uint32_t _uniformMask = 0;
+	mutable bool _resolved = false;
 
-		glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-			std::cout << "Vertex Compilation failed" << infoLog << std::endl;
-		}
-
-		//Compile Fragment
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
+	void resolve() const
+	{
+		_resolved = true;
+		if (!ID || !ShaderCache::Get().Resolve(ID))
+			return;
+		reflectUniforms();
+		FrameUniforms::BindBlocks(ID);
+	}
 
-		glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-		if (!success)
+	//Every active uniform by name, arrays also as "name" and "name[i]" for each element
+	void reflectUniforms() const
+	{
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<std::pair<std::string, GLint>> found;
+		std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
 		{
-			glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-			std::cout << "Fragment Compilation failed" << infoLog << std::endl;
+			GLint size = 0;
+			GLenum type = 0;
+			GLsizei length = 0;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location < 0)
+				continue;
+			found.push_back(std::make_pair(name, location));
+
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				std::string base = name.substr(0, name.size() - 3);
+				found.push_back(std::make_pair(base, location));
+				for (GLint element = 1; element < size; element++)
+				{
+					std::string elementName = base + "[" + std::to_string(element) + "]";
+					found.push_back(std::make_pair(elementName, glGetUniformLocation(ID, elementName.c_str())));
+				}
+			}
 		}
 
-		//Shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		glLinkProgram(ID);
-
-		glGetProgramiv(ID, GL_LINK_STATUS, &success);
-		if (!success)
+		uint32_t capacity = 16;
+		while (capacity < found.size() * 2)
+			capacity *= 2;
+		UniformSlot empty = { 0, EMPTY_SLOT };
+		_uniforms.assign(capacity, empty);
+		_uniformMask = capacity - 1;
+		for (unsigned int i = 0; i < found.size(); i++)
 		{
-			glGetProgramInfoLog(ID, 512, NULL, infoLog);
-			std::cout << "Link failed" << std::endl;
+			uint32_t hash = HashUniformName(found[i].first.c_str(), found[i].first.size());
+			uint32_t slot = hash & _uniformMask;
+			while (_uniforms[slot].location != EMPTY_SLOT && _uniforms[slot].hash != hash)
+				slot = (slot + 1) & _uniformMask;
+			if (_uniforms[slot].location != EMPTY_SLOT)
+				std::cout << "Uniform name hash collision: " << found[i].first << std::endl;
+			_uniforms[slot].hash = hash;
+			_uniforms[slot].location = found[i].second;
 		}
-
-		//Free memory
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-	}
-
-	void use()
-	{
-		glUseProgram(ID);
-	}
-
-	//Uniform Setters
-	void setBool(const std::string& name, bool value) const
-	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-	}
-	void setInt(const std::string& name, int value) const
-	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-	}
-	void setFloat(const std::string& name, float value) const
-	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-	}
-	void setMat4(const std::string& name, const glm::mat4& value) const
-	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()),1, GL_FALSE, &value[0][0]);
-	}
-	void setVec3(const std::string& name, const glm::vec3& value) const
-	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
 	}
 };
@@ -0,0 +1,361 @@
+#include "ShaderCache.h"
+#include "MeshCache.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+
+namespace
+{
+	const uint32_t PROGRAM_MAGIC = 0x5053444C; //"LDSP"
+	const uint32_t PROGRAM_VERSION = 1;
+
+	struct ProgramHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t driverHash;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	bool HasExtension(const char* name)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (extension && std::strcmp(extension, name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	std::string DriverString(GLenum name)
+	{
+		const char* value = (const char*)glGetString(name);
+		return value ? value : "";
+	}
+
+	//Reads the compile status, only once the program is being resolved
+	bool CheckStage(GLuint shader, const char* stage, const std::string& name)
+	{
+		int success;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, 512, NULL, infoLog);
+			std::cout << stage << " Compilation failed (" << name << ")" << infoLog << std::endl;
+		}
+		return success != 0;
+	}
+}
+
+ShaderCache& ShaderCache::Get()
+{
+	static ShaderCache cache;
+	return cache;
+}
+
+ShaderCache::ShaderCache() : _getProgramBinary(nullptr), _programBinary(nullptr), _programParameteri(nullptr), _binaries(false), _parallel(false),
+	_driverHash(0), _requests(0), _binaryLoads(0), _compiles(0), _staleBinaries(0), _waitMs(0.0)
+{
+}
+
+void ShaderCache::Initialise(GLADloadproc loader)
+{
+	//Let the driver pick how many compiler threads to run
+	MaxShaderCompilerThreadsProc maxCompilerThreads = nullptr;
+	if (HasExtension("GL_KHR_parallel_shader_compile"))
+		maxCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsKHR");
+	else if (HasExtension("GL_ARB_parallel_shader_compile"))
+		maxCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsARB");
+	if (maxCompilerThreads)
+	{
+		maxCompilerThreads(0xFFFFFFFF);
+		_parallel = true;
+	}
+
+	bool core = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+	if (!core && !HasExtension("GL_ARB_get_program_binary"))
+	{
+		std::cout << "Program binaries not supported, shaders are compiled every start" << std::endl;
+		return;
+	}
+	_getProgramBinary = (GetProgramBinaryProc)loader("glGetProgramBinary");
+	_programBinary = (ProgramBinaryProc)loader("glProgramBinary");
+	_programParameteri = (ProgramParameteriProc)loader("glProgramParameteri");
+
+	//Drivers may support the entry points yet offer no binary format at all
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	_binaries = _getProgramBinary && _programBinary && _programParameteri && formats > 0;
+
+	std::string driver = DriverString(GL_VENDOR) + '\n' + DriverString(GL_RENDERER) + '\n' + DriverString(GL_VERSION);
+	_driverHash = MeshCache::Hash(driver.data(), driver.size());
+}
+
+GLuint ShaderCache::Acquire(const std::string& vertexPath, const std::string& fragmentPath, const std::vector<std::string>& defines)
+{
+	_requests++;
+	std::string vertexSource;
+	std::string fragmentSource;
+	if (!ReadSource(vertexPath, vertexSource) || !ReadSource(fragmentPath, fragmentSource))
+	{
+		std::cout << "Shader file read failed" << std::endl;
+		return 0;
+	}
+	vertexSource = Preprocess(vertexSource, defines);
+	fragmentSource = Preprocess(fragmentSource, defines);
+
+	//Both stages, so the same file used as either never collides
+	uint64_t key = MeshCache::Hash(vertexSource.data(), vertexSource.size());
+	key = MeshCache::Hash(fragmentSource.data(), fragmentSource.size(), key ^ 0x9E3779B97F4A7C15ULL);
+	std::unordered_map<uint64_t, GLuint>::iterator found = _programs.find(key);
+	if (found != _programs.end())
+		return found->second;
+
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+	size_t slash = vertexPath.find_last_of("/\\");
+
+	PendingProgram pending;
+	pending.key = key;
+	pending.name = vertexPath + " + " + fragmentPath;
+	pending.binaryPath = (slash == std::string::npos ? std::string() : vertexPath.substr(0, slash + 1)) + name + ".program.cooked";
+	pending.vertexSource.swap(vertexSource);
+	pending.fragmentSource.swap(fragmentSource);
+	pending.vertex = 0;
+	pending.fragment = 0;
+	pending.fromBinary = false;
+
+	//No status queries here, each one would wait for the driver
+	GLuint program = glCreateProgram();
+	if (_binaries && submitBinary(program, pending))
+		pending.fromBinary = true;
+	else
+		submitCompile(program, pending);
+
+	_pending[program] = std::move(pending);
+	_programs[key] = program;
+	return program;
+}
+
+bool ShaderCache::Resolve(GLuint program)
+{
+	std::unordered_map<GLuint, PendingProgram>::iterator found = _pending.find(program);
+	if (found == _pending.end())
+		return _failed.find(program) == _failed.end();
+
+	PendingProgram pending = std::move(found->second);
+	_pending.erase(found);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool linked = finish(program, pending);
+	if (!linked && pending.fromBinary)
+	{
+		//Drivers may still refuse a binary they wrote, e.g. after an update that kept the version string
+		_staleBinaries++;
+		pending.fromBinary = false;
+		submitCompile(program, pending);
+		linked = finish(program, pending);
+	}
+	_waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (!linked)
+		_failed.insert(program);
+	return linked;
+}
+
+void ShaderCache::Poll()
+{
+	if (!_parallel)
+		return;
+
+	std::vector<GLuint> finished;
+	for (std::unordered_map<GLuint, PendingProgram>::const_iterator i = _pending.begin(); i != _pending.end(); ++i)
+	{
+		GLint done = GL_FALSE;
+		glGetProgramiv(i->first, GL_COMPLETION_STATUS_KHR, &done);
+		if (done)
+			finished.push_back(i->first);
+	}
+	for (unsigned int i = 0; i < finished.size(); i++)
+		Resolve(finished[i]);
+}
+
+void ShaderCache::PrintStats() const
+{
+	std::cout << "Shader programs: " << _requests << " requested, " << _programs.size() << " unique, " << _binaryLoads << " loaded from binaries, "
+		<< _compiles << " compiled";
+	if (_staleBinaries)
+		std::cout << " (" << _staleBinaries << " stale binaries replaced)";
+	if (!_pending.empty())
+		std::cout << ", " << _pending.size() << " still pending";
+	std::cout << ", " << _waitMs << " ms waiting on the driver";
+	if (!_parallel)
+		std::cout << ", parallel compile off";
+	if (!_binaries)
+		std::cout << ", binary cache off";
+	std::cout << std::endl;
+}
+
+std::string ShaderCache::Preprocess(const std::string& source, const std::vector<std::string>& defines)
+{
+	if (defines.empty())
+		return source;
+
+	std::string block;
+	for (unsigned int i = 0; i < defines.size(); i++)
+		block += "#define " + defines[i] + "\n";
+
+	//#version has to stay the first statement
+	size_t version = source.find("#version");
+	if (version == std::string::npos)
+		return block + source;
+	size_t lineEnd = source.find('\n', version);
+	if (lineEnd == std::string::npos)
+		return source + "\n" + block;
+	return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+}
+
+void ShaderCache::submitCompile(GLuint program, PendingProgram& pending)
+{
+	const char* vShaderCode = pending.vertexSource.c_str();
+	const char* fShaderCode = pending.fragmentSource.c_str();
+
+	//Compile Vertex
+	pending.vertex = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(pending.vertex, 1, &vShaderCode, NULL);
+	glCompileShader(pending.vertex);
+
+	//Compile Fragment
+	pending.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(pending.fragment, 1, &fShaderCode, NULL);
+	glCompileShader(pending.fragment);
+
+	//Shader Program
+	glAttachShader(program, pending.vertex);
+	glAttachShader(program, pending.fragment);
+	if (_binaries)
+		_programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+}
+
+bool ShaderCache::submitBinary(GLuint program, const PendingProgram& pending)
+{
+	std::ifstream in(pending.binaryPath, std::ios::binary);
+	if (!in)
+		return false;
+
+	ProgramHeader header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != PROGRAM_MAGIC || header.version != PROGRAM_VERSION ||
+		header.key != pending.key || header.driverHash != _driverHash || header.length == 0)
+	{
+		_staleBinaries++;
+		return false;
+	}
+	std::vector<char> binary(header.length);
+	if (!in.read(binary.data(), binary.size()))
+	{
+		_staleBinaries++;
+		return false;
+	}
+
+	//Whether the driver accepts it is only known once Resolve checks the link status
+	_programBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+	return true;
+}
+
+bool ShaderCache::finish(GLuint program, PendingProgram& pending)
+{
+	bool compiled = true;
+	if (!pending.fromBinary)
+	{
+		compiled &= CheckStage(pending.vertex, "Vertex", pending.name);
+		compiled &= CheckStage(pending.fragment, "Fragment", pending.name);
+	}
+
+	int success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success && !pending.fromBinary)
+	{
+		char infoLog[512];
+		glGetProgramInfoLog(program, 512, NULL, infoLog);
+		std::cout << "Link failed (" << pending.name << ")" << infoLog << std::endl;
+	}
+
+	//Free memory
+	if (!pending.fromBinary)
+	{
+		glDetachShader(program, pending.vertex);
+		glDetachShader(program, pending.fragment);
+		glDeleteShader(pending.vertex);
+		glDeleteShader(pending.fragment);
+		pending.vertex = pending.fragment = 0;
+	}
+
+	if (!compiled || !success)
+		return false;
+
+	if (pending.fromBinary)
+	{
+		_binaryLoads++;
+	}
+	else
+	{
+		_compiles++;
+		if (_binaries)
+			saveBinary(pending.binaryPath, pending.key, program);
+	}
+	return true;
+}
+
+void ShaderCache::saveBinary(const std::string& path, uint64_t key, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	_getProgramBinary(program, length, &written, &format, binary.data());
+	if (written <= 0)
+		return;
+
+	ProgramHeader header;
+	header.magic = PROGRAM_MAGIC;
+	header.version = PROGRAM_VERSION;
+	header.key = key;
+	header.driverHash = _driverHash;
+	header.format = format;
+	header.length = (uint32_t)written;
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "Failed to write program binary: " << path << std::endl;
+		return;
+	}
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(binary.data(), written);
+}
+
+bool ShaderCache::ReadSource(const std::string& path, std::string& source)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+	std::stringstream stream;
+	stream << file.rdbuf();
+	source = stream.str();
+	return true;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+//GL 4.1 / ARB_get_program_binary, not in the GL 3.3 loader
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+//KHR/ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+//Linked programs keyed by a hash of their preprocessed sources, so every Shader built from the
+//same files and defines shares one program. Linked programs are also saved as driver program
+//binaries ("<key>.program.cooked" next to the vertex shader) and loaded on the next start
+//without compiling any GLSL. Binaries from another driver, GPU or driver version are ignored.
+//
+//Acquire only submits work: compiles and links are issued without asking the driver for their
+//status, so a batch of Shaders compiles in parallel (KHR_parallel_shader_compile) or at least
+//behind the asset loading that follows. Status is checked by Resolve when a program is first used.
+class ShaderCache
+{
+public:
+	static ShaderCache& Get();
+
+	//GL thread, after glad: looks up the program binary and parallel compile entry points. Without
+	//it, or without driver support, programs are still shared but always compiled.
+	void Initialise(GLADloadproc loader);
+
+	//GL thread: program for the two files with "#define <define>" lines inserted after #version.
+	//Owned by the cache, 0 when the sources can't be read. The program may still be compiling,
+	//call Resolve before querying or drawing with it.
+	GLuint Acquire(const std::string& vertexPath, const std::string& fragmentPath, const std::vector<std::string>& defines = {});
+
+	//GL thread: waits for program to finish, logs errors and stores its binary. False when it
+	//failed to build. Cheap once a program is resolved.
+	bool Resolve(GLuint program);
+
+	//GL thread: resolves the programs the driver reports as finished, never waits. Only does
+	//anything with parallel compile, without it asking would block.
+	void Poll();
+
+	unsigned int GetPending() const { return (unsigned int)_pending.size(); }
+
+	void PrintStats() const;
+
+	//Source with the defines inserted after the #version line
+	static std::string Preprocess(const std::string& source, const std::vector<std::string>& defines);
+
+private:
+	ShaderCache();
+	ShaderCache(const ShaderCache&) = delete;
+	ShaderCache& operator=(const ShaderCache&) = delete;
+
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+	typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+	//Submitted program whose status hasn't been checked yet
+	struct PendingProgram
+	{
+		uint64_t key;
+		std::string name;
+		std::string binaryPath;
+		std::string vertexSource; //Kept for binaries, the driver may still refuse them
+		std::string fragmentSource;
+		GLuint vertex;
+		GLuint fragment;
+		bool fromBinary;
+	};
+
+	std::unordered_map<uint64_t, GLuint> _programs;
+	std::unordered_map<GLuint, PendingProgram> _pending;
+	std::unordered_set<GLuint> _failed;
+	GetProgramBinaryProc _getProgramBinary;
+	ProgramBinaryProc _programBinary;
+	ProgramParameteriProc _programParameteri;
+	bool _binaries;
+	bool _parallel;
+	uint64_t _driverHash; //Vendor, renderer and version strings
+
+	//Stats
+	unsigned int _requests, _binaryLoads, _compiles, _staleBinaries;
+	double _waitMs; //Time Resolve spent blocked on the driver
+
+	void submitCompile(GLuint program, PendingProgram& pending);
+	bool submitBinary(GLuint program, const PendingProgram& pending);
+	bool finish(GLuint program, PendingProgram& pending);
+	void saveBinary(const std::string& path, uint64_t key, GLuint program);
+
+	static bool ReadSource(const std::string& path, std::string& source);
+};
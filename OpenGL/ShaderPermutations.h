@@ -0,0 +1,102 @@
+#pragma once
+#include "Shader.h"
+#include "FrameUniforms.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+//Permutation features, each one a #define in the shader source (see Shaders/Model2.fs)
+const uint32_t SHADER_UNLIT = 1u << 0;			//UNLIT: diffuse colour only, no lighting
+const uint32_t SHADER_SPECULAR_MAP = 1u << 1;	//SPECULAR_MAP: sample texture_specular1, otherwise the diffuse colour is reused
+const uint32_t SHADER_NORMAL_MAP = 1u << 2;		//NORMAL_MAP: perturb the normal with texture_normal1 (BC5 xy)
+const uint32_t SHADER_HEIGHT_MAP = 1u << 3;		//HEIGHT_MAP: bump the normal with the slope of texture_height1
+
+//One vertex/fragment pair compiled into a Shader per feature set. Meshes ask for the features
+//their textures need (Mesh::shaderFeatures) and get the cheapest variant that covers them;
+//features the set doesn't support are dropped. Variants are built on first request and kept,
+//identical ones share a program through ShaderCache.
+class ShaderPermutations
+{
+public:
+	//setup runs on each variant the first time it's used, for constants such as material.shininess
+	ShaderPermutations(const char* vertexPath, const char* fragmentPath, uint32_t supported, std::function<void(const Shader&)> setup = nullptr)
+		: _vertexPath(vertexPath), _fragmentPath(fragmentPath), _supported(supported), _setup(std::move(setup))
+	{
+	}
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+	//Submits the variant's compile without waiting for it. Call for everything a scene will draw
+	//before the first Get so the variants compile together.
+	void Prepare(uint32_t features)
+	{
+		find(features);
+	}
+
+	//Variant covering features, ready to use()
+	const Shader& Get(uint32_t features)
+	{
+		Variant& variant = find(features);
+		if (!variant.ready)
+		{
+			variant.ready = true;
+			if (_setup)
+			{
+				variant.shader->use();
+				_setup(*variant.shader);
+			}
+		}
+		return *variant.shader;
+	}
+
+	unsigned int GetVariantCount() const { return (unsigned int)_variants.size(); }
+	uint32_t GetSupported() const { return _supported; }
+
+	//Defines for a feature set. The point light count always comes from FrameUniforms so the
+	//Lights block can't drift from LightsBlock.
+	static std::vector<std::string> Defines(uint32_t features)
+	{
+		std::vector<std::string> defines;
+		defines.push_back("NR_POINTS_LIGHTS " + std::to_string(POINT_LIGHT_COUNT));
+		if (features & SHADER_UNLIT)
+			defines.push_back("UNLIT");
+		if (features & SHADER_SPECULAR_MAP)
+			defines.push_back("SPECULAR_MAP");
+		if (features & SHADER_NORMAL_MAP)
+			defines.push_back("NORMAL_MAP");
+		if (features & SHADER_HEIGHT_MAP)
+			defines.push_back("HEIGHT_MAP");
+		return defines;
+	}
+
+private:
+	struct Variant
+	{
+		std::unique_ptr<Shader> shader;
+		bool ready = false;
+	};
+
+	std::string _vertexPath;
+	std::string _fragmentPath;
+	uint32_t _supported;
+	std::function<void(const Shader&)> _setup;
+	std::unordered_map<uint32_t, Variant> _variants;
+
+	Variant& find(uint32_t features)
+	{
+		//Unlit variants never read the lighting maps
+		features &= _supported;
+		if (features & SHADER_UNLIT)
+			features &= ~(SHADER_SPECULAR_MAP | SHADER_NORMAL_MAP | SHADER_HEIGHT_MAP);
+
+		Variant& variant = _variants[features];
+		if (!variant.shader)
+			variant.shader.reset(new Shader(_vertexPath.c_str(), _fragmentPath.c_str(), Defines(features)));
+		return variant;
+	}
+};
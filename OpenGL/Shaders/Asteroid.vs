@@ -1,15 +1,67 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMatrix;
+//AsteroidInstance.h: 16 bytes a rock
+layout (location = 3) in vec2 aOrbit; //Radius, phase
+layout (location = 4) in vec2 aShape; //Height, scale
+layout (location = 5) in uint aRotationSeed;
 
 out vec2 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+//Per frame camera, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+//Packed meshes store positions as 0..1 within the mesh bounds
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
+
+//Seconds, and the belt's turn rate in radians a second (AsteroidInstance::BeltRotation)
+uniform float time;
+uniform float orbitSpeed;
+
+//Integer hash, so every rock gets its own spin from one seed
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float unitFloat(uint x)
+{
+    return float(x & 0xFFFFu) / 65535.0;
+}
+
+//Rodrigues: v turned by angle about the unit axis
+vec3 rotateAbout(vec3 v, vec3 axis, float angle)
+{
+    float s = sin(angle);
+    float c = cos(angle);
+    return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
 
 void main()
 {
+    uint h0 = hash(aRotationSeed);
+    uint h1 = hash(h0);
+    vec3 axis = normalize(vec3(unitFloat(h0), unitFloat(h0 >> 16), unitFloat(h1)) * 2.0 - 1.0 + vec3(0.0, 1e-3, 0.0));
+    float spinSpeed = mix(0.1, 0.8, unitFloat(h1 >> 16)) * (((h1 & 1u) == 0u) ? 1.0 : -1.0);
+    float startAngle = unitFloat(hash(h1)) * 6.2831853;
+
+    vec3 position = aPos * positionScale + positionOffset;
+    position = rotateAbout(position, axis, startAngle + time * spinSpeed) * aShape.y;
+
+    float angle = aOrbit.y + time * orbitSpeed;
+    position += vec3(sin(angle) * aOrbit.x, aShape.x, cos(angle) * aOrbit.x);
+
     TexCoords = aTexCoords;
-    gl_Position = projection * view * aInstanceMatrix * vec4(aPos, 1.0f); 
-}
\ No newline at end of file
+    gl_Position = projection * view * vec4(position, 1.0f);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+//Passes on the instances the vertex shader kept, captured by transform feedback
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+flat in uvec4 Instance[];
+flat in int Visible[];
+
+//Captured as the same 16 bytes the culler was given
+flat out uvec4 instanceData;
+
+void main()
+{
+    if (Visible[0] == 0)
+        return;
+    instanceData = Instance[0];
+    EmitVertex();
+    EndPrimitive();
+}
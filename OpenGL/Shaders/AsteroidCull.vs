@@ -0,0 +1,22 @@
+#version 330 core
+//One point per instance, see GpuInstanceCuller.h
+layout (location = 0) in vec4 aSphere; //Center and radius, in the space of the planes
+layout (location = 1) in uvec4 aInstance; //Passed on untouched
+
+flat out uvec4 Instance;
+flat out int Visible;
+
+//Inward facing frustum planes (xyz normal, w distance)
+uniform vec4 planes[6];
+uniform vec3 viewPos;
+uniform float maxDistance;
+
+void main()
+{
+    bool inside = distance(aSphere.xyz, viewPos) - aSphere.w <= maxDistance;
+    for (int i = 0; i < 6; i++)
+        inside = inside && dot(planes[i].xyz, aSphere.xyz) + planes[i].w >= -aSphere.w;
+
+    Instance = aInstance;
+    Visible = inside ? 1 : 0;
+}
@@ -7,49 +7,54 @@ struct Material {
 	float shininess;
 };
 
+//Light structs are laid out for std140: every vec3 is followed by a float or starts a new 16 bytes
 struct DirLight {
 	vec3 direction;
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
 };
-uniform DirLight dirLight;
 
 struct PointLight {
 	vec3 position;
-	
 	float constant;
-	float linear;
-	float quadratic;
-	
 	vec3 ambient;
+	float linear;
 	vec3 diffuse;
+	float quadratic;
 	vec3 specular;
 };
 #define NR_POINTS_LIGHTS 1
-uniform PointLight pointLights[NR_POINTS_LIGHTS];
 
 struct Spotlight {
 	vec3 position;
-	vec3 direction;
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-	
-	//Attenuation Elements
 	float constant;
+	vec3 direction;
 	float linear;
+	vec3 ambient;
 	float quadratic;
-	
-	//Cutoffs
+	vec3 diffuse;
 	float cutOff;
+	vec3 specular;
 	float outerCutOff;
 };
-uniform Spotlight spotLight;
+
+//Per frame camera and lights, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+layout (std140) uniform Lights
+{
+	DirLight dirLight;
+	PointLight pointLights[NR_POINTS_LIGHTS];
+	Spotlight spotLight;
+};
 
 uniform Material material;
-uniform vec3 viewPos;
 
 in vec3 FragPos;
 in vec3 Normal;
@@ -4,8 +4,14 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+//Per frame camera, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 
 out vec3 FragPos;
 out vec3 Normal;
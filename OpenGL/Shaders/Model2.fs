@@ -1,69 +1,104 @@
 #version 330 core
 out vec4 FragColor;
 
+//Permutations (ShaderPermutations.h): UNLIT, SPECULAR_MAP, NORMAL_MAP, HEIGHT_MAP and NR_POINTS_LIGHTS
+//are defined after #version by the program that builds this shader
 struct Material {
 	sampler2D texture_diffuse1;
+#ifdef SPECULAR_MAP
 	sampler2D texture_specular1;
+#endif
+#ifdef NORMAL_MAP
+	sampler2D texture_normal1;
+#endif
+#ifdef HEIGHT_MAP
+	sampler2D texture_height1;
+#endif
 	float shininess;
 };
 
+//Light structs are laid out for std140: every vec3 is followed by a float or starts a new 16 bytes
 struct DirLight {
 	vec3 direction;
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
 };
-uniform DirLight dirLight;
 
 struct PointLight {
 	vec3 position;
-	
 	float constant;
-	float linear;
-	float quadratic;
-	
 	vec3 ambient;
+	float linear;
 	vec3 diffuse;
+	float quadratic;
 	vec3 specular;
 };
+#ifndef NR_POINTS_LIGHTS
 #define NR_POINTS_LIGHTS 1
-uniform PointLight pointLights[NR_POINTS_LIGHTS];
+#endif
 
 struct Spotlight {
 	vec3 position;
-	vec3 direction;
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-	
-	//Attenuation Elements
 	float constant;
+	vec3 direction;
 	float linear;
+	vec3 ambient;
 	float quadratic;
-	
-	//Cutoffs
+	vec3 diffuse;
 	float cutOff;
+	vec3 specular;
 	float outerCutOff;
 };
-uniform Spotlight spotLight;
+
+//Per frame camera and lights, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+layout (std140) uniform Lights
+{
+	DirLight dirLight;
+	PointLight pointLights[NR_POINTS_LIGHTS];
+	Spotlight spotLight;
+};
 
 uniform Material material;
-uniform vec3 viewPos;
+uniform float bumpScale = 1.0; //World units for a height map value of 1
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
+//Surface colours, each map is sampled once per fragment
+vec3 albedo;
+vec3 specularColor;
+
 //Prototypes
 vec3 CalcDirLight(DirLight light, vec3 Normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 Normal, vec3 fragPos, vec3 viewDir);  
 vec3 CalcSpotLight(Spotlight light, vec3 Normal, vec3 fragPos, vec3 viewDir);
+vec3 PerturbNormal(vec3 Normal);
 
 void main()
 {
+	albedo = vec3(texture(material.texture_diffuse1, TexCoords));
+#ifdef UNLIT
+	FragColor = vec4(albedo, 1.0f);
+#else
+#ifdef SPECULAR_MAP
+	specularColor = vec3(texture(material.texture_specular1, TexCoords));
+#else
+	//Without a specular map the sampler used to read unit 0, the diffuse map
+	specularColor = albedo;
+#endif
+
 	vec3 norm = normalize(Normal);
 	vec3 viewDir = normalize(viewPos - FragPos);
+	norm = PerturbNormal(norm);
 	
 	//Directional Lighting
 	vec3 result = CalcDirLight(dirLight, norm, viewDir);
@@ -77,6 +112,44 @@ void main()
 		
 	//Output
 	FragColor = vec4(result, 1.0f);
+#endif
+}
+
+//Normal and height maps without vertex tangents: the tangent frame comes from the screen space
+//derivatives of the position and texture coordinates
+vec3 PerturbNormal(vec3 Normal)
+{
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+	vec3 dp1 = dFdx(FragPos);
+	vec3 dp2 = dFdy(FragPos);
+	vec2 duv1 = dFdx(TexCoords);
+	vec2 duv2 = dFdy(TexCoords);
+#endif
+#ifdef HEIGHT_MAP
+	//Bump mapping from the height slope (surface gradient)
+	float height = texture(material.texture_height1, TexCoords).r * bumpScale;
+	float dhdx = dFdx(height);
+	float dhdy = dFdy(height);
+	vec3 r1 = cross(dp2, Normal);
+	vec3 r2 = cross(Normal, dp1);
+	float det = dot(dp1, r1);
+	vec3 gradient = sign(det) * (dhdx * r1 + dhdy * r2);
+	Normal = normalize(abs(det) * Normal - gradient);
+#endif
+#ifdef NORMAL_MAP
+	//Cotangent frame
+	vec3 dp2perp = cross(dp2, Normal);
+	vec3 dp1perp = cross(Normal, dp1);
+	vec3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+	vec3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+	float invmax = inversesqrt(max(dot(T, T), dot(B, B)));
+
+	//BC5 keeps x and y, z is rebuilt
+	vec2 xy = texture(material.texture_normal1, TexCoords).rg * 2.0 - 1.0;
+	vec3 mapped = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+	Normal = normalize(mat3(T * invmax, B * invmax, Normal) * mapped);
+#endif
+	return Normal;
 }
 
 vec3 CalcDirLight(DirLight light, vec3 Normal, vec3 viewDir)
@@ -92,9 +165,9 @@ vec3 CalcDirLight(DirLight light, vec3 Normal, vec3 viewDir)
 	float spec = pow(max(dot(viewDir, reflectDir),0.0), material.shininess);
 	
 	//Output
-	vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-	vec3 diffuse  = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));  
+	vec3 ambient = light.ambient * albedo;
+	vec3 diffuse  = light.diffuse * diff * albedo;
+	vec3 specular = light.specular * spec * specularColor;  
 	return (ambient + diffuse + specular);
 }
 
@@ -115,9 +188,9 @@ vec3 CalcPointLight(PointLight light, vec3 Normal, vec3 fragPos, vec3 viewDir)
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
 	
     //Output
-    vec3 ambient  = light.ambient  * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient  = light.ambient  * albedo;
+    vec3 diffuse  = light.diffuse  * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
@@ -136,9 +209,9 @@ vec3 CalcSpotLight(Spotlight light, vec3 Normal, vec3 fragPos, vec3 viewDir)
 	vec3 reflectDir = reflect(-lightDir, Normal);
 	float spec = pow(max(dot(viewDir, reflectDir),0.0), material.shininess);
 	
-	vec3 ambient  = light.ambient  * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+	vec3 ambient  = light.ambient  * albedo;
+    vec3 diffuse  = light.diffuse  * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
 	
 	//Spotlight
 	float theta = dot(lightDir, normalize(-light.direction));
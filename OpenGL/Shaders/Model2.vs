@@ -4,8 +4,18 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+//Per frame camera, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+//Packed meshes store positions as 0..1 within the mesh bounds
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
 
 out vec3 FragPos;
 out vec3 Normal;
@@ -13,8 +23,9 @@ out vec2 TexCoords;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
-	FragPos = vec3(model * vec4(aPos, 1.0));
+	vec3 position = aPos * positionScale + positionOffset;
+	gl_Position = projection * view * model * vec4(position, 1.0);
+	FragPos = vec3(model * vec4(position, 1.0));
 	Normal = mat3(transpose(inverse(model))) * aNormal;  
 	TexCoords = aTexCoords;
 }
\ No newline at end of file
@@ -3,12 +3,17 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+//Per frame camera, shared by every program (FrameUniforms.h)
+layout (std140) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 
 void main()
 {
 	TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0); //Rotation only, the sky never moves
     gl_Position = pos.xyww;
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+//Writes the tile each pixel wants: page x, y, level and virtual texture id, see VirtualTexture.h
+uniform sampler2D vtPageTable;
+uniform vec2 vtSize;
+uniform vec2 vtScale;
+uniform float vtMaxLevel;
+uniform float vtFeedbackBias;	//log2 of how much smaller the feedback target is
+uniform int vtId;
+
+float VirtualLevel(vec2 uv)
+{
+    vec2 texel = uv * vtScale * vtSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    return 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+}
+
+void main()
+{
+    vec2 virtualUV = fract(TexCoords) * vtScale;
+    int level = int(clamp(VirtualLevel(TexCoords) - vtFeedbackBias, 0.0, vtMaxLevel));
+    ivec2 pages = textureSize(vtPageTable, level);
+    ivec2 page = min(ivec2(virtualUV * vec2(pages)), pages - 1);
+    FragColor = vec4(vec2(page), float(level), float(vtId)) / 255.0;
+}
@@ -0,0 +1,44 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+//Virtual texture, see VirtualTexture.h
+uniform sampler2D vtPageTable;	//One texel per tile, one mip per level: atlas slot x, y and the tile's level
+uniform sampler2D vtPhysical;	//Atlas of resident tiles
+uniform vec2 vtSize;			//Level 0 texels, padded to whole pages
+uniform vec2 vtScale;			//Image size / vtSize
+uniform float vtMaxLevel;
+uniform float vtAtlasSize;
+
+const float TILE_SIZE = 128.0;
+const float TILE_BORDER = 4.0;
+const float TILE_STRIDE = 136.0;
+
+//Level from the screen space footprint of a texel
+float VirtualLevel(vec2 uv)
+{
+    vec2 texel = uv * vtScale * vtSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    return 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+}
+
+vec4 SampleVirtual(vec2 uv)
+{
+    vec2 virtualUV = fract(uv) * vtScale;
+    int level = int(clamp(VirtualLevel(uv), 0.0, vtMaxLevel));
+    ivec2 pages = textureSize(vtPageTable, level);
+    vec4 entry = texelFetch(vtPageTable, min(ivec2(virtualUV * vec2(pages)), pages - 1), level) * 255.0;
+
+    //Resident tile may be a coarser one covering this page
+    vec2 mappedPages = vec2(textureSize(vtPageTable, int(entry.z + 0.5)));
+    vec2 local = fract(virtualUV * mappedPages);
+    vec2 physical = (floor(entry.xy + 0.5) * TILE_STRIDE + TILE_BORDER + local * TILE_SIZE) / vtAtlasSize;
+    return textureLod(vtPhysical, physical, 0.0);
+}
+
+void main()
+{
+    FragColor = SampleVirtual(TexCoords);
+}
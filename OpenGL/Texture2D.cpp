@@ -1,94 +1,88 @@
 #include "Texture2D.h"
+#include "GLState.h"
+#include "ImageDecoder.h"
 #include <iostream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-Texture2D::Texture2D()
+Texture2D::Texture2D() : _ID(0), _width(0), _height(0), _nrChannels(0), _cached(false)
 {
 
 }
 
 Texture2D::~Texture2D()
 {
-	glDeleteTextures(1, &_ID);
+	if (_cached)
+		TextureCache::Get().Release(_ID);
+	else
+		GLState::Get().DeleteTexture(_ID);
 }
 
 bool Texture2D::Load(char* path, bool flip)
 {
-	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(flip);
-	unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
-	_width = width;
-	_height = height;
-	_nrChannels = nrChannels;
-	glGenTextures(1, &_ID);
-	glBindTexture(GL_TEXTURE_2D, _ID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	if (data)
-	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
-	{
-		std::cout << "Failed to load texture" << std::endl;
-		return false;
-	}
-	stbi_image_free(data);
-	return true;
+	return loadImage(path, flip, GL_RGB, true);
 }
 
 bool Texture2D::LoadPNG(char* path, bool flip)
 {
-	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(flip);
-	unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
-	_width = width;
-	_height = height;
-	_nrChannels = nrChannels;
+	return loadImage(path, flip, GL_RGBA, false);
+}
+
+bool Texture2D::loadImage(const char* path, bool flip, GLint internalFormat, bool mipmaps)
+{
+	//RGBA rows are always 4 byte aligned, whatever the file held
+	DecodeOptions options;
+	options.flip = flip;
+	options.channels = 4;
+	DecodedImage image;
+	bool decoded = ImageDecoder::Decode(path, options, image);
+	_width = image.width;
+	_height = image.height;
+	_nrChannels = image.channels;
 	glGenTextures(1, &_ID);
-	glBindTexture(GL_TEXTURE_2D, _ID);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, _ID);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	if (data)
-	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		//glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
+	if (!decoded)
 	{
 		std::cout << "Failed to load texture" << std::endl;
 		return false;
 	}
-	stbi_image_free(data);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+	if (mipmaps)
+		glGenerateMipmap(GL_TEXTURE_2D);
 	return true;
 }
 
+void Texture2D::LoadStreamed(char* path, bool flip)
+{
+	_ID = TextureCache::Get().Acquire(path, flip);
+	_cached = true;
+	_width = 0;
+	_height = 0;
+	_nrChannels = 0;
+}
+
 bool Texture2D::LoadCubeMap(std::vector<std::string> faces)
 {
-	glGenTextures(1, &_ID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, _ID);
+	//All faces decode in parallel
+	DecodeOptions options;
+	options.channels = 4;
+	std::vector<DecodedImage> images = ImageDecoder::Get().DecodeAll(faces, options);
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+	glGenTextures(1, &_ID);
+	GLState::Get().BindTexture(GL_TEXTURE_CUBE_MAP, _ID);
+	for (unsigned int i = 0; i < images.size(); i++)
 	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
+		if (!images[i].pixels)
 		{
 			std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
 			return false;
 		}
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, images[i].width, images[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, images[i].pixels);
+		images[i].Free();
 	}
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -1,6 +1,8 @@
 #pragma once
 #include <GLFW/glfw3.h>
 #include <glad/include/glad/glad.h>
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 #include <vector>
 #include <string>
 
@@ -9,6 +11,9 @@ class Texture2D
 private:
 	GLuint _ID;
 	int _width, _height, _nrChannels;
+	bool _cached; //Shared through TextureCache, released rather than deleted
+
+	bool loadImage(const char* path, bool flip, GLint internalFormat, bool mipmaps);
 
 public:
 	Texture2D();
@@ -16,8 +21,10 @@ public:
 	bool Load(char* path, bool flip);
 	bool LoadPNG(char* path, bool flip);
 	bool LoadCubeMap(std::vector<std::string> faces);
+	void LoadStreamed(char* path, bool flip);
 
-	GLuint GetID() const { return _ID; }
+	//Streamed textures report the placeholder until they are resident
+	GLuint GetID() const { return TextureStreamer::Get().Resolve(_ID); }
 	int GetWidth() const { return _width; }
 	int GetHeight() const { return _height;}
 };
@@ -0,0 +1,193 @@
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+
+#include <vector>
+#include <iostream>
+#include <cctype>
+
+TextureCache& TextureCache::Get()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+TextureCache::TextureCache() : _pathHits(0), _contentHits(0), _misses(0), _evictions(0)
+{
+	//Contents are only known once a worker has read the file, never hashed on the GL thread
+	TextureStreamer::Get().SetContentHandler([this](unsigned int texture, uint64_t contentKey) { return identify(texture, contentKey); });
+}
+
+std::string TextureCache::Canonicalize(const std::string& path)
+{
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find_first_of("/\\", start);
+		if (end == std::string::npos)
+			end = path.size();
+
+		std::string part = path.substr(start, end - start);
+		if (part == "..")
+		{
+			if (!parts.empty() && parts.back() != ".." && !parts.back().empty())
+				parts.pop_back();
+			else
+				parts.push_back(part);
+		}
+		else if (part != "." && !(part.empty() && !parts.empty()))
+		{
+			//An empty first part keeps the leading slash of absolute paths
+			parts.push_back(part);
+		}
+		start = end + 1;
+	}
+
+	std::string canonical;
+	for (unsigned int i = 0; i < parts.size(); i++)
+	{
+		if (i > 0)
+			canonical += '/';
+		canonical += parts[i];
+	}
+#ifdef _WIN32
+	for (unsigned int i = 0; i < canonical.size(); i++)
+		canonical[i] = (char)std::tolower((unsigned char)canonical[i]);
+#endif
+	return canonical;
+}
+
+unsigned int TextureCache::Acquire(const std::string& path, bool flip, TextureUsage usage)
+{
+	std::string key = Canonicalize(path) + (flip ? "|flip" : "") + (usage == TextureUsage::Normal ? "|normal" : "");
+	std::unordered_map<std::string, unsigned int>::iterator byPath = _byPath.find(key);
+	if (byPath != _byPath.end())
+	{
+		_pathHits++;
+		addReference(_entries[byPath->second]);
+		return byPath->second;
+	}
+
+	_misses++;
+	unsigned int texture = TextureStreamer::Get().Request(path, flip, usage);
+	Entry& entry = _entries[texture];
+	entry.contentKey = 0;
+	entry.hasContent = false;
+	entry.original = 0;
+	entry.references = 1;
+	entry.hits = 0;
+	entry.unreferenced = _unreferenced.end();
+	_byPath[key] = texture;
+	return texture;
+}
+
+//Same bytes under another name: the first texture streamed with them stands in for the rest
+unsigned int TextureCache::identify(unsigned int texture, uint64_t contentKey)
+{
+	std::unordered_map<unsigned int, Entry>::iterator it = _entries.find(texture);
+	if (it == _entries.end())
+		return 0;
+
+	std::unordered_map<uint64_t, unsigned int>::iterator byContent = _byContent.find(contentKey);
+	if (byContent == _byContent.end() || byContent->second == texture)
+	{
+		it->second.contentKey = contentKey;
+		it->second.hasContent = true;
+		_byContent[contentKey] = texture;
+		return 0;
+	}
+
+	//Kept alive for as long as the duplicate is cached
+	_contentHits++;
+	_misses--;
+	it->second.original = byContent->second;
+	addReference(_entries[byContent->second]);
+	return byContent->second;
+}
+
+void TextureCache::addReference(Entry& entry)
+{
+	entry.hits++;
+	if (entry.references++ == 0)
+	{
+		_unreferenced.erase(entry.unreferenced);
+		entry.unreferenced = _unreferenced.end();
+	}
+}
+
+void TextureCache::Release(unsigned int texture)
+{
+	std::unordered_map<unsigned int, Entry>::iterator it = _entries.find(texture);
+	if (it == _entries.end() || it->second.references == 0)
+		return;
+	if (--it->second.references == 0)
+		it->second.unreferenced = _unreferenced.insert(_unreferenced.end(), texture);
+}
+
+void TextureCache::Trim(size_t budgetBytes)
+{
+	size_t unreferencedBytes = 0;
+	for (std::list<unsigned int>::const_iterator it = _unreferenced.begin(); it != _unreferenced.end(); ++it)
+		unreferencedBytes += getEvictableBytes(*it);
+
+	std::list<unsigned int>::iterator it = _unreferenced.begin();
+	while (unreferencedBytes > budgetBytes && it != _unreferenced.end())
+	{
+		unsigned int texture = *it;
+
+		//Still streaming in, its upload owns the name until it is resident
+		if (!TextureStreamer::Get().IsResident(texture))
+		{
+			++it;
+			continue;
+		}
+
+		unreferencedBytes -= getEvictableBytes(texture);
+		Entry& entry = _entries[texture];
+		for (std::unordered_map<std::string, unsigned int>::iterator path = _byPath.begin(); path != _byPath.end();)
+		{
+			if (path->second == texture)
+				path = _byPath.erase(path);
+			else
+				++path;
+		}
+		if (entry.hasContent)
+			_byContent.erase(entry.contentKey);
+		unsigned int original = entry.original;
+		_entries.erase(texture);
+		it = _unreferenced.erase(it);
+
+		TextureStreamer::Get().Delete(texture);
+		_evictions++;
+
+		//Joins the end of the list once nothing else uses it
+		if (original)
+		{
+			Release(original);
+			if (_entries[original].references == 0)
+				unreferencedBytes += getEvictableBytes(original);
+		}
+	}
+}
+
+//A duplicate has no storage of its own but keeps its original off the unreferenced list
+size_t TextureCache::getEvictableBytes(unsigned int texture)
+{
+	unsigned int original = _entries[texture].original;
+	return TextureStreamer::Get().GetTextureBytes(original ? original : texture);
+}
+
+void TextureCache::PrintStats() const
+{
+	size_t residentBytes = 0;
+	size_t savedBytes = 0;
+	for (std::unordered_map<unsigned int, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+	{
+		size_t bytes = TextureStreamer::Get().GetTextureBytes(it->first);
+		residentBytes += bytes;
+		savedBytes += bytes * it->second.hits;
+	}
+	std::cout << "Texture cache: " << _entries.size() << " textures (" << residentBytes / (1024 * 1024) << " MB), "
+		<< _pathHits << " path hits, " << _contentHits << " content hits, " << _misses << " misses, "
+		<< _evictions << " evicted, " << savedBytes / (1024 * 1024) << " MB of duplicate uploads avoided" << std::endl;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <list>
+#include <unordered_map>
+
+#include "TextureCompressor.h"
+
+//Process-wide texture cache. Requests are looked up by canonical path, so the same image reached
+//through another relative path is decoded once. A path seen for the first time is streamed, and
+//once its decode worker has hashed the file, a texture with the same contents already streamed
+//(the image copied next to another model) stands in for it instead of a second upload. Textures
+//are refcounted; unreferenced ones stay cached until Trim evicts the least recently released.
+class TextureCache
+{
+public:
+	static TextureCache& Get();
+
+	//GL thread: returns a (streamed) texture holding path and adds a reference to it
+	unsigned int Acquire(const std::string& path, bool flip = false, TextureUsage usage = TextureUsage::Color);
+	void Release(unsigned int texture);
+
+	//GL thread: deletes unreferenced textures, oldest first, until they fit budgetBytes
+	void Trim(size_t budgetBytes = DEFAULT_BUDGET);
+
+	void PrintStats() const;
+
+	//"Models/./earth/../earth\\a.png" -> "Models/earth/a.png", lower case on Windows
+	static std::string Canonicalize(const std::string& path);
+
+	static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+private:
+	TextureCache();
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	struct Entry
+	{
+		uint64_t contentKey;
+		bool hasContent;
+		unsigned int original; //Texture this duplicates and holds a reference to, 0 if none
+		unsigned int references;
+		unsigned int hits;
+		std::list<unsigned int>::iterator unreferenced;
+	};
+
+	std::unordered_map<std::string, unsigned int> _byPath;
+	std::unordered_map<uint64_t, unsigned int> _byContent;
+	std::unordered_map<unsigned int, Entry> _entries;
+	std::list<unsigned int> _unreferenced; //Least recently released first
+
+	unsigned int _pathHits;
+	unsigned int _contentHits;
+	unsigned int _misses;
+	unsigned int _evictions;
+
+	void addReference(Entry& entry);
+	size_t getEvictableBytes(unsigned int texture);
+
+	//TextureStreamer::ContentHandler
+	unsigned int identify(unsigned int texture, uint64_t contentKey);
+};
@@ -0,0 +1,510 @@
+#include "TextureCompressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+//Cooked file layout
+//	CookedTextureHeader
+//	CookedLevelRecord[levelCount]
+//	Block data (16 byte aligned per level)
+namespace
+{
+	const uint32_t COOKED_MAGIC = 0x54434C44; //"LDCT"
+	const uint32_t COOKED_VERSION = 1;
+	const uint64_t COOKED_ALIGN = 16;
+
+	const uint32_t FLAG_FLIP = 1;
+	const uint32_t FLAG_NORMAL = 2;
+
+	struct CookedTextureHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t format;
+		uint32_t flags;
+		uint32_t levelCount;
+		uint32_t reserved;
+	};
+
+	struct CookedLevelRecord
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	uint64_t AlignUp(uint64_t value)
+	{
+		return (value + COOKED_ALIGN - 1) & ~(COOKED_ALIGN - 1);
+	}
+
+	uint32_t FlagsFor(bool flip, TextureUsage usage)
+	{
+		return (flip ? FLAG_FLIP : 0) | (usage == TextureUsage::Normal ? FLAG_NORMAL : 0);
+	}
+
+	size_t LevelBytes(BlockFormat format, unsigned int width, unsigned int height)
+	{
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * CompressedImage::BlockBytesFor(format);
+	}
+
+	//RGB888 <-> RGB565
+	uint16_t Pack565(const float* colour)
+	{
+		int r = std::min(31, std::max(0, (int)(colour[0] * 31.0f / 255.0f + 0.5f)));
+		int g = std::min(63, std::max(0, (int)(colour[1] * 63.0f / 255.0f + 0.5f)));
+		int b = std::min(31, std::max(0, (int)(colour[2] * 31.0f / 255.0f + 0.5f)));
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void Unpack565(uint16_t packed, int* colour)
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		colour[0] = (r << 3) | (r >> 2);
+		colour[1] = (g << 2) | (g >> 4);
+		colour[2] = (b << 3) | (b >> 2);
+	}
+
+	//Nearest of the four palette entries for every texel, 2 bits each
+	uint32_t PickBC1Indices(const unsigned char* rgba, uint16_t c0, uint16_t c1)
+	{
+		int palette[4][3];
+		Unpack565(c0, palette[0]);
+		Unpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const unsigned char* texel = rgba + i * 4;
+			int best = 0;
+			int bestDistance = 1 << 30;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = texel[0] - palette[p][0];
+				int dg = texel[1] - palette[p][1];
+				int db = texel[2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+		return indices;
+	}
+
+	void WriteBC1(unsigned char* block, uint16_t c0, uint16_t c1, uint32_t indices)
+	{
+		block[0] = (unsigned char)(c0 & 0xFF);
+		block[1] = (unsigned char)(c0 >> 8);
+		block[2] = (unsigned char)(c1 & 0xFF);
+		block[3] = (unsigned char)(c1 >> 8);
+		for (int i = 0; i < 4; i++)
+			block[4 + i] = (unsigned char)(indices >> (i * 8));
+	}
+
+	//Averages 2x2 texels of an RGBA image, normal maps are renormalised afterwards
+	void Downsample(const std::vector<unsigned char>& source, unsigned int width, unsigned int height, TextureUsage usage,
+		std::vector<unsigned char>& target, unsigned int& targetWidth, unsigned int& targetHeight)
+	{
+		targetWidth = std::max(1u, width / 2);
+		targetHeight = std::max(1u, height / 2);
+		target.resize((size_t)targetWidth * targetHeight * 4);
+		for (unsigned int y = 0; y < targetHeight; y++)
+		{
+			unsigned int y0 = std::min(y * 2, height - 1);
+			unsigned int y1 = std::min(y * 2 + 1, height - 1);
+			for (unsigned int x = 0; x < targetWidth; x++)
+			{
+				unsigned int x0 = std::min(x * 2, width - 1);
+				unsigned int x1 = std::min(x * 2 + 1, width - 1);
+				const unsigned char* a = &source[((size_t)y0 * width + x0) * 4];
+				const unsigned char* b = &source[((size_t)y0 * width + x1) * 4];
+				const unsigned char* c = &source[((size_t)y1 * width + x0) * 4];
+				const unsigned char* d = &source[((size_t)y1 * width + x1) * 4];
+				unsigned char* out = &target[((size_t)y * targetWidth + x) * 4];
+				for (int channel = 0; channel < 4; channel++)
+					out[channel] = (unsigned char)((a[channel] + b[channel] + c[channel] + d[channel] + 2) / 4);
+
+				if (usage == TextureUsage::Normal)
+				{
+					float n[3];
+					for (int channel = 0; channel < 3; channel++)
+						n[channel] = out[channel] / 127.5f - 1.0f;
+					float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+					if (length > 0.0f)
+					{
+						for (int channel = 0; channel < 3; channel++)
+							out[channel] = (unsigned char)std::min(255.0f, std::max(0.0f, (n[channel] / length + 1.0f) * 127.5f + 0.5f));
+					}
+				}
+			}
+		}
+	}
+}
+
+GLenum CompressedImage::InternalFormat() const
+{
+	switch (format)
+	{
+	case BlockFormat::BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat::BC4:
+		return GL_COMPRESSED_RED_RGTC1;
+	case BlockFormat::BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	default:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+}
+
+//Endpoints from the principal axis of the block's colours, inset a little, then one least
+//squares pass refitting them to the chosen indices
+void TextureCompressor::EncodeBC1(const unsigned char* rgba, unsigned char* block)
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+			mean[c] += rgba[i * 4 + c];
+	}
+	for (int c = 0; c < 3; c++)
+		mean[c] /= 16.0f;
+
+	float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; //rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float r = rgba[i * 4 + 0] - mean[0];
+		float g = rgba[i * 4 + 1] - mean[1];
+		float b = rgba[i * 4 + 2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+
+	//Power iteration
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 4; iteration++)
+	{
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+	float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < 3; c++)
+			t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+		t /= axisLength;
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	float inset = (maxT - minT) / 16.0f;
+	minT += inset;
+	maxT -= inset;
+
+	float high[3], low[3];
+	for (int c = 0; c < 3; c++)
+	{
+		high[c] = mean[c] + axis[c] * maxT;
+		low[c] = mean[c] + axis[c] * minT;
+	}
+	uint16_t c0 = Pack565(high);
+	uint16_t c1 = Pack565(low);
+	uint32_t indices = PickBC1Indices(rgba, c0, c1);
+
+	//Refit: each texel is w*c0 + (1-w)*c1 for w in {1, 0, 2/3, 1/3}
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		float a = weights[(indices >> (i * 2)) & 3];
+		float b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 3; c++)
+		{
+			ax[c] += a * rgba[i * 4 + c];
+			bx[c] += b * rgba[i * 4 + c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) > 1e-6f)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			high[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+			low[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+		}
+		uint16_t refit0 = Pack565(high);
+		uint16_t refit1 = Pack565(low);
+		if (refit0 != refit1)
+		{
+			c0 = refit0;
+			c1 = refit1;
+		}
+	}
+
+	//c0 > c1 selects the four colour mode
+	if (c0 < c1)
+		std::swap(c0, c1);
+	indices = c0 == c1 ? 0 : PickBC1Indices(rgba, c0, c1);
+	WriteBC1(block, c0, c1, indices);
+}
+
+//Eight value mode: endpoints are the block's extremes with six evenly spaced values between
+void TextureCompressor::EncodeBC4(const unsigned char* rgba, int channel, unsigned char* block)
+{
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		low = std::min(low, (int)rgba[i * 4 + channel]);
+		high = std::max(high, (int)rgba[i * 4 + channel]);
+	}
+
+	block[0] = (unsigned char)high;
+	block[1] = (unsigned char)low;
+	uint64_t indices = 0;
+	if (high > low)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			//Step from low (0) to high (7), index 0 is high, 1 is low and 2-7 run back down
+			int step = ((rgba[i * 4 + channel] - low) * 14 + (high - low)) / ((high - low) * 2);
+			int index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+			indices |= (uint64_t)index << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		block[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+void TextureCompressor::Compress(const unsigned char* pixels, int width, int height, int channels, TextureUsage usage, CompressedImage& image)
+{
+	//Expand to RGBA, grey images repeat their channel
+	std::vector<unsigned char> level((size_t)width * height * 4);
+	bool opaque = true;
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		const unsigned char* in = pixels + i * channels;
+		unsigned char* out = &level[i * 4];
+		if (channels <= 2)
+		{
+			out[0] = out[1] = out[2] = in[0];
+			out[3] = channels == 2 ? in[1] : 255;
+		}
+		else
+		{
+			out[0] = in[0];
+			out[1] = in[1];
+			out[2] = in[2];
+			out[3] = channels == 4 ? in[3] : 255;
+		}
+		opaque = opaque && out[3] == 255;
+	}
+
+	if (usage == TextureUsage::Normal)
+		image.format = BlockFormat::BC5;
+	else if (channels == 1)
+		image.format = BlockFormat::BC4;
+	else
+		image.format = opaque ? BlockFormat::BC1 : BlockFormat::BC3;
+
+	//Lay out the chain
+	image.levels.clear();
+	size_t size = 0;
+	unsigned int levelWidth = (unsigned int)width, levelHeight = (unsigned int)height;
+	while (true)
+	{
+		CompressedImage::Level info = { levelWidth, levelHeight, size, LevelBytes(image.format, levelWidth, levelHeight) };
+		image.levels.push_back(info);
+		size += info.size;
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+		levelWidth = std::max(1u, levelWidth / 2);
+		levelHeight = std::max(1u, levelHeight / 2);
+	}
+	image.storage.resize(size);
+
+	std::vector<unsigned char> next;
+	size_t blockBytes = image.BlockBytes();
+	for (unsigned int l = 0; l < image.levels.size(); l++)
+	{
+		const CompressedImage::Level& info = image.levels[l];
+		unsigned char* block = &image.storage[info.offset];
+		for (unsigned int by = 0; by < info.height; by += 4)
+		{
+			for (unsigned int bx = 0; bx < info.width; bx += 4)
+			{
+				//Edge blocks repeat the last row/column
+				unsigned char texels[16 * 4];
+				for (unsigned int y = 0; y < 4; y++)
+				{
+					unsigned int sy = std::min(by + y, info.height - 1);
+					for (unsigned int x = 0; x < 4; x++)
+					{
+						unsigned int sx = std::min(bx + x, info.width - 1);
+						std::memcpy(texels + (y * 4 + x) * 4, &level[((size_t)sy * info.width + sx) * 4], 4);
+					}
+				}
+
+				switch (image.format)
+				{
+				case BlockFormat::BC1:
+					EncodeBC1(texels, block);
+					break;
+				case BlockFormat::BC3:
+					EncodeBC4(texels, 3, block);
+					EncodeBC1(texels, block + 8);
+					break;
+				case BlockFormat::BC4:
+					EncodeBC4(texels, 0, block);
+					break;
+				case BlockFormat::BC5:
+					EncodeBC4(texels, 0, block);
+					EncodeBC4(texels, 1, block + 8);
+					break;
+				}
+				block += blockBytes;
+			}
+		}
+
+		if (l + 1 < image.levels.size())
+		{
+			unsigned int nextWidth, nextHeight;
+			Downsample(level, info.width, info.height, usage, next, nextWidth, nextHeight);
+			level.swap(next);
+		}
+	}
+
+	image.file.Close();
+	image.data = image.storage.data();
+	image.size = image.storage.size();
+}
+
+bool TextureCompressor::Load(const std::string& cookedPath, uint64_t sourceHash, bool flip, TextureUsage usage, CompressedImage& image)
+{
+	MappedFile& file = image.file;
+	if (!file.Open(cookedPath))
+		return false;
+
+	const unsigned char* data = file.GetData();
+	size_t size = file.GetSize();
+	CookedTextureHeader header;
+	if (size < sizeof(header))
+	{
+		file.Close();
+		return false;
+	}
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != COOKED_MAGIC || header.version != COOKED_VERSION || header.sourceHash != sourceHash ||
+		header.flags != FlagsFor(flip, usage) || header.format > (uint32_t)BlockFormat::BC5 || header.levelCount == 0 ||
+		sizeof(header) + (uint64_t)header.levelCount * sizeof(CookedLevelRecord) > size)
+	{
+		file.Close();
+		return false;
+	}
+
+	image.format = (BlockFormat)header.format;
+	image.levels.clear();
+	for (unsigned int l = 0; l < header.levelCount; l++)
+	{
+		CookedLevelRecord record;
+		std::memcpy(&record, data + sizeof(header) + l * sizeof(CookedLevelRecord), sizeof(record));
+		if (record.offset > size || record.size > size - record.offset || record.size != LevelBytes(image.format, record.width, record.height))
+		{
+			std::cout << "Cooked texture file is corrupt: " << cookedPath << std::endl;
+			file.Close();
+			image.levels.clear();
+			return false;
+		}
+
+		CompressedImage::Level level = { record.width, record.height, (size_t)record.offset, (size_t)record.size };
+		image.levels.push_back(level);
+	}
+
+	image.storage.clear();
+	image.data = data;
+	image.size = size;
+	return true;
+}
+
+bool TextureCompressor::Save(const std::string& cookedPath, uint64_t sourceHash, bool flip, TextureUsage usage, const CompressedImage& image)
+{
+	CookedTextureHeader header;
+	header.magic = COOKED_MAGIC;
+	header.version = COOKED_VERSION;
+	header.sourceHash = sourceHash;
+	header.format = (uint32_t)image.format;
+	header.flags = FlagsFor(flip, usage);
+	header.levelCount = (uint32_t)image.levels.size();
+	header.reserved = 0;
+
+	std::vector<CookedLevelRecord> records;
+	uint64_t offset = AlignUp(sizeof(header) + header.levelCount * sizeof(CookedLevelRecord));
+	for (unsigned int l = 0; l < image.levels.size(); l++)
+	{
+		CookedLevelRecord record;
+		record.width = image.levels[l].width;
+		record.height = image.levels[l].height;
+		record.offset = offset;
+		record.size = image.levels[l].size;
+		offset = AlignUp(offset + record.size);
+		records.push_back(record);
+	}
+
+	std::ofstream out(cookedPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "Failed to write cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	static const char padding[COOKED_ALIGN] = {};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!records.empty())
+		out.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(CookedLevelRecord));
+	for (unsigned int l = 0; l < image.levels.size(); l++)
+	{
+		out.write(padding, (std::streamsize)(records[l].offset - (uint64_t)out.tellp()));
+		out.write(reinterpret_cast<const char*>(image.data + image.levels[l].offset), image.levels[l].size);
+	}
+
+	if (!out)
+	{
+		std::cout << "Failed to write cooked texture: " << cookedPath << std::endl;
+		out.close();
+		std::remove(cookedPath.c_str());
+		return false;
+	}
+	return true;
+}
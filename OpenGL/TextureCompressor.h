@@ -0,0 +1,84 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//S3TC is an extension the GL 3.3 loader does not list, every desktop driver exposes it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+//What the texels mean, picks the block format
+enum class TextureUsage
+{
+	Color,	//BC1, BC3 with alpha, BC4 for single channel images
+	Normal	//BC5 holding x and y, z = sqrt(1 - x*x - y*y) in the shader
+};
+
+enum class BlockFormat : uint32_t
+{
+	BC1,	//RGB, 8 bytes per 4x4 block
+	BC3,	//RGBA, 16 bytes
+	BC4,	//R, 8 bytes
+	BC5		//RG, 16 bytes
+};
+
+//Block compressed image with its whole mip chain, levels stored largest first
+struct CompressedImage
+{
+	struct Level
+	{
+		unsigned int width;
+		unsigned int height;
+		size_t offset; //Into data
+		size_t size;
+	};
+
+	BlockFormat format = BlockFormat::BC1;
+	std::vector<Level> levels;
+
+	const unsigned char* data = nullptr; //Into storage or file
+	size_t size = 0;
+	std::vector<unsigned char> storage;
+	MappedFile file;
+
+	size_t BlockBytes() const { return BlockBytesFor(format); }
+	GLenum InternalFormat() const;
+
+	void Clear()
+	{
+		levels.clear();
+		std::vector<unsigned char>().swap(storage);
+		file.Close();
+		data = nullptr;
+		size = 0;
+	}
+
+	static size_t BlockBytesFor(BlockFormat format) { return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16; }
+};
+
+//CPU encoder for BC1/3/4/5 and the cooked container that keeps its output next to the
+//source ("earth.jpg.cooked"), valid while the source hash, flip and usage match. Runs on
+//worker threads.
+class TextureCompressor
+{
+public:
+	static std::string CookedPath(const std::string& sourcePath) { return sourcePath + ".cooked"; }
+
+	//Builds the box filtered mip chain of an 8 bit image with 1-4 channels and encodes every level
+	static void Compress(const unsigned char* pixels, int width, int height, int channels, TextureUsage usage, CompressedImage& image);
+
+	static bool Load(const std::string& cookedPath, uint64_t sourceHash, bool flip, TextureUsage usage, CompressedImage& image);
+	static bool Save(const std::string& cookedPath, uint64_t sourceHash, bool flip, TextureUsage usage, const CompressedImage& image);
+
+	//16 RGBA texels in, one block out
+	static void EncodeBC1(const unsigned char* rgba, unsigned char* block);
+	static void EncodeBC4(const unsigned char* rgba, int channel, unsigned char* block);
+};
@@ -0,0 +1,301 @@
+#include "TextureStreamer.h"
+#include "GLState.h"
+#include "ImageDecoder.h"
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+TextureStreamer& TextureStreamer::Get()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+TextureStreamer::TextureStreamer() : _initialised(false), _placeholder(0), _nextSlot(0)
+{
+	for (unsigned int i = 0; i < SLOT_COUNT; i++)
+	{
+		_slots[i].buffer = 0;
+		_slots[i].fence = 0;
+	}
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	//GL objects are left to the context, which is gone by the time statics are destroyed
+	StreamRequest* request = nullptr;
+	while (_decoded.TryPop(request))
+		delete request;
+	for (unsigned int i = 0; i < _uploading.size(); i++)
+		delete _uploading[i];
+	for (unsigned int i = 0; i < _finishing.size(); i++)
+		delete _finishing[i];
+}
+
+void TextureStreamer::initialise()
+{
+	//Grey 1x1 stand-in
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &_placeholder);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, _placeholder);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+
+	//Staging ring
+	for (unsigned int i = 0; i < SLOT_COUNT; i++)
+	{
+		glGenBuffers(1, &_slots[i].buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _slots[i].buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, SLOT_SIZE, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	_initialised = true;
+}
+
+unsigned int TextureStreamer::Request(const std::string& path, bool flip, TextureUsage usage)
+{
+	if (!_initialised)
+		initialise();
+
+	StreamRequest* request = new StreamRequest();
+	glGenTextures(1, &request->texture);
+	request->path = path;
+	request->flip = flip;
+	request->usage = usage;
+	request->contentKey = 0;
+	request->hasContent = false;
+	request->allocated = false;
+	request->nextLevel = 0;
+	request->levelOffset = 0;
+	request->done = 0;
+	_pending.insert(request->texture);
+
+	unsigned int texture = request->texture;
+	ImageDecoder::Get().Submit([this, request]
+	{
+		load(request);
+		_decoded.Push(request);
+	});
+	return texture;
+}
+
+//Worker thread: the cooked blocks when they are current, otherwise decode, compress and cook
+void TextureStreamer::load(StreamRequest* request)
+{
+	uint64_t sourceHash = 0;
+	if (!MeshCache::HashFile(request->path, sourceHash))
+		return;
+	request->contentKey = sourceHash ^ (request->flip ? 1 : 0) ^ (request->usage == TextureUsage::Normal ? 2 : 0);
+	request->hasContent = true;
+
+	std::string cookedPath = TextureCompressor::CookedPath(request->path);
+	if (TextureCompressor::Load(cookedPath, sourceHash, request->flip, request->usage, request->image))
+		return;
+
+	DecodeOptions options;
+	options.flip = request->flip;
+	DecodedImage decoded;
+	if (!ImageDecoder::Decode(request->path, options, decoded))
+		return;
+
+	TextureCompressor::Compress(decoded.pixels, decoded.width, decoded.height, decoded.channels, request->usage, request->image);
+	decoded.Free();
+	TextureCompressor::Save(cookedPath, sourceHash, request->flip, request->usage, request->image);
+}
+
+bool TextureStreamer::acquireSlot(StagingSlot*& slot)
+{
+	slot = &_slots[_nextSlot];
+	if (slot->fence)
+	{
+		//Still being read by the GPU, try again next frame
+		GLenum status = glClientWaitSync(slot->fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+			return false;
+		glDeleteSync(slot->fence);
+		slot->fence = 0;
+	}
+	_nextSlot = (_nextSlot + 1) % SLOT_COUNT;
+	return true;
+}
+
+void TextureStreamer::allocate(StreamRequest* request)
+{
+	//Storage for every level, contents follow from the staging ring
+	const CompressedImage& image = request->image;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, request->texture);
+	for (unsigned int l = 0; l < image.levels.size(); l++)
+		glCompressedTexImage2D(GL_TEXTURE_2D, l, image.InternalFormat(), image.levels[l].width, image.levels[l].height, 0, (GLsizei)image.levels[l].size, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	request->allocated = true;
+
+	size_t bytes = 0;
+	for (unsigned int l = 0; l < image.levels.size(); l++)
+		bytes += image.levels[l].size;
+	_sizes[request->texture] = bytes;
+}
+
+void TextureStreamer::Delete(unsigned int id)
+{
+	if (!IsResident(id))
+		return;
+	_duplicates.erase(id);
+	GLState::Get().DeleteTexture(id);
+	_sizes.erase(id);
+}
+
+void TextureStreamer::finish(StreamRequest* request)
+{
+	request->done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	request->image.Clear();
+	_finishing.push_back(request);
+}
+
+void TextureStreamer::Update()
+{
+	if (!_initialised)
+		return;
+
+	StreamRequest* decoded = nullptr;
+	while (_decoded.TryPop(decoded))
+	{
+		if (!decoded->image.levels.empty())
+		{
+			unsigned int original = decoded->hasContent && _contentHandler ? _contentHandler(decoded->texture, decoded->contentKey) : 0;
+			if (original && original != decoded->texture)
+			{
+				//The name stays reserved but empty, so it can't be handed out again while it is mapped
+				_duplicates[decoded->texture] = original;
+				_pending.erase(decoded->texture);
+				delete decoded;
+				continue;
+			}
+			_uploading.push_back(decoded);
+			continue;
+		}
+
+		//Keep the texture complete so it samples like the placeholder rather than black
+		std::cout << "Failed to load texture: " << decoded->path << std::endl;
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		GLState::Get().BindTexture(GL_TEXTURE_2D, decoded->texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		_pending.erase(decoded->texture);
+		delete decoded;
+	}
+
+	//Each slot carries whole block rows, from as many consecutive levels as fit
+	struct Piece
+	{
+		unsigned int level;
+		unsigned int y, height;
+		size_t offset, bytes;
+	};
+	std::vector<Piece> pieces;
+
+	size_t budget = BYTES_PER_FRAME;
+	while (!_uploading.empty() && budget > 0)
+	{
+		StreamRequest* request = _uploading.front();
+		if (!request->allocated)
+			allocate(request);
+
+		StagingSlot* slot = nullptr;
+		if (!acquireSlot(slot))
+			break;
+
+		const CompressedImage& image = request->image;
+		pieces.clear();
+		size_t used = 0;
+		while (request->nextLevel < image.levels.size())
+		{
+			const CompressedImage::Level& level = image.levels[request->nextLevel];
+			size_t rowBytes = (size_t)((level.width + 3) / 4) * image.BlockBytes();
+			size_t rows = std::min((level.size - request->levelOffset) / rowBytes, (SLOT_SIZE - used) / rowBytes);
+			if (rows == 0)
+				break;
+
+			Piece piece;
+			piece.level = request->nextLevel;
+			piece.y = (unsigned int)(request->levelOffset / rowBytes * 4);
+			piece.height = std::min(level.height - piece.y, (unsigned int)rows * 4);
+			piece.offset = used;
+			piece.bytes = rows * rowBytes;
+			pieces.push_back(piece);
+
+			used += piece.bytes;
+			request->levelOffset += piece.bytes;
+			if (request->levelOffset >= level.size)
+			{
+				request->nextLevel++;
+				request->levelOffset = 0;
+			}
+		}
+
+		if (pieces.empty())
+			break;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+		unsigned char* staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, used, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (!staging)
+		{
+			//Rewind and try again next frame
+			request->nextLevel = pieces[0].level;
+			request->levelOffset = pieces[0].y / 4 * ((image.levels[pieces[0].level].width + 3) / 4) * image.BlockBytes();
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			break;
+		}
+		for (unsigned int i = 0; i < pieces.size(); i++)
+		{
+			const CompressedImage::Level& level = image.levels[pieces[i].level];
+			size_t rowBytes = (size_t)((level.width + 3) / 4) * image.BlockBytes();
+			std::memcpy(staging + pieces[i].offset, image.data + level.offset + pieces[i].y / 4 * rowBytes, pieces[i].bytes);
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		GLState::Get().BindTexture(GL_TEXTURE_2D, request->texture);
+		for (unsigned int i = 0; i < pieces.size(); i++)
+		{
+			const CompressedImage::Level& level = image.levels[pieces[i].level];
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, pieces[i].level, 0, pieces[i].y, level.width, pieces[i].height,
+				image.InternalFormat(), (GLsizei)pieces[i].bytes, (void*)pieces[i].offset);
+		}
+		slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		budget = used < budget ? budget - used : 0;
+
+		if (request->nextLevel >= image.levels.size())
+		{
+			_uploading.pop_front();
+			finish(request);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	//Resident once the GPU has consumed the last upload
+	for (unsigned int i = 0; i < _finishing.size();)
+	{
+		StreamRequest* request = _finishing[i];
+		GLenum status = glClientWaitSync(request->done, 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			glDeleteSync(request->done);
+			_pending.erase(request->texture);
+			delete request;
+			_finishing[i] = _finishing.back();
+			_finishing.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
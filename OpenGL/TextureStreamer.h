@@ -0,0 +1,121 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+
+#include "LockFreeQueue.h"
+#include "TextureCompressor.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//Streams image files into GL textures without stalling the render thread.
+//Files are decoded and block compressed on the ImageDecoder pool (or read back already compressed
+//from their cooked file), then Update copies a budgeted number of bytes per frame into a ring
+//of pixel unpack buffers and issues glCompressedTexSubImage2D for every mip level from them.
+//Fences guard reuse of each ring slot and mark a texture resident once its last upload has
+//completed. Until then Resolve maps the texture to a placeholder so draws never sample a
+//partial image. A texture whose contents turn out to duplicate another's is never uploaded,
+//Resolve maps it to the other for good.
+class TextureStreamer
+{
+public:
+	static TextureStreamer& Get();
+
+	//Returns a texture name straight away, its contents arrive a few frames later
+	unsigned int Request(const std::string& path, bool flip = false, TextureUsage usage = TextureUsage::Color);
+
+	//Called by Update for each decoded texture with the hash of its file, flip and usage. Returns
+	//a texture with the same contents to stand in for it, or 0 to upload it.
+	typedef std::function<unsigned int(unsigned int texture, uint64_t contentKey)> ContentHandler;
+	void SetContentHandler(ContentHandler handler) { _contentHandler = std::move(handler); }
+
+	//GL thread, once per frame
+	void Update();
+
+	//Texture to bind for id: id itself once resident, the placeholder before that, or the texture
+	//it duplicates
+	unsigned int Resolve(unsigned int id) const
+	{
+		if (!_duplicates.empty())
+		{
+			std::unordered_map<unsigned int, unsigned int>::const_iterator duplicate = _duplicates.find(id);
+			if (duplicate != _duplicates.end())
+				id = duplicate->second;
+		}
+		if (_pending.empty() || _pending.find(id) == _pending.end())
+			return id;
+		return _placeholder;
+	}
+
+	bool IsResident(unsigned int id) const { return _pending.find(id) == _pending.end(); }
+	unsigned int GetPendingCount() const { return (unsigned int)_pending.size(); }
+
+	//GPU memory of a streamed texture including its mip chain, 0 until its size is known
+	size_t GetTextureBytes(unsigned int id) const
+	{
+		std::unordered_map<unsigned int, size_t>::const_iterator it = _sizes.find(id);
+		return it == _sizes.end() ? 0 : it->second;
+	}
+
+	//Deletes a resident texture, or forgets a duplicate (not what it stands in for)
+	void Delete(unsigned int id);
+
+private:
+	TextureStreamer();
+	~TextureStreamer();
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	struct StreamRequest
+	{
+		unsigned int texture;
+		std::string path;
+		bool flip;
+		TextureUsage usage;
+
+		//Filled in by the decoding worker
+		uint64_t contentKey;
+		bool hasContent;
+		CompressedImage image;
+
+		//Upload progress
+		bool allocated;
+		unsigned int nextLevel;
+		size_t levelOffset; //Bytes of nextLevel already uploaded
+		GLsync done;
+	};
+
+	struct StagingSlot
+	{
+		unsigned int buffer;
+		GLsync fence;
+	};
+
+	static const unsigned int SLOT_COUNT = 3;
+	static const size_t SLOT_SIZE = 8 * 1024 * 1024;
+	static const size_t BYTES_PER_FRAME = 16 * 1024 * 1024;
+
+	bool _initialised;
+	unsigned int _placeholder;
+	StagingSlot _slots[SLOT_COUNT];
+	unsigned int _nextSlot;
+
+	std::unordered_set<unsigned int> _pending;
+	std::unordered_map<unsigned int, size_t> _sizes;
+	std::unordered_map<unsigned int, unsigned int> _duplicates; //Empty name -> texture with its contents
+	ContentHandler _contentHandler;
+	LockFreeQueue<StreamRequest*> _decoded;
+	std::deque<StreamRequest*> _uploading;
+	std::vector<StreamRequest*> _finishing;
+
+	void initialise();
+	bool acquireSlot(StagingSlot*& slot);
+	void allocate(StreamRequest* request);
+	void finish(StreamRequest* request);
+
+	static void load(StreamRequest* request);
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+
+//Fixed set of worker threads running queued tasks in submission order
+class ThreadPool
+{
+public:
+	//0 uses one worker per hardware thread, leaving one for the render thread
+	explicit ThreadPool(unsigned int threadCount = 0) : _stopping(false)
+	{
+		if (threadCount == 0)
+		{
+			unsigned int hardware = std::thread::hardware_concurrency();
+			threadCount = hardware > 1 ? hardware - 1 : 1;
+		}
+		for (unsigned int i = 0; i < threadCount; i++)
+			_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		for (unsigned int i = 0; i < _workers.size(); i++)
+			_workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//Pool shared by the asset loaders
+	static ThreadPool& Get()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void Submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.push(std::move(task));
+		}
+		_wake.notify_one();
+	}
+
+	unsigned int GetThreadCount() const { return (unsigned int)_workers.size(); }
+
+private:
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+				if (_stopping && _tasks.empty())
+					return;
+				task = std::move(_tasks.front());
+				_tasks.pop();
+			}
+			task();
+		}
+	}
+};
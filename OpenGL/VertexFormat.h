@@ -0,0 +1,65 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+};
+
+//GPU vertex layout chosen per Model at upload
+enum class VertexFormat {
+	Full,	//Vertex as is, 32 bytes
+	Packed	//PackedVertex, 16 bytes
+};
+
+const unsigned int VERTEX_FORMAT_COUNT = 2;
+
+//Compact vertex: positions quantised to the mesh bounds (decoded with positionScale/positionOffset
+//in the vertex shader), 10:10:10:2 normals and half float UVs
+struct PackedVertex {
+	unsigned short Position[4]; //w is padding
+	unsigned int Normal;
+	unsigned short TexCoords[2];
+};
+
+inline size_t VertexStride(VertexFormat format)
+{
+	return format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+//Points attributes 0-2 (position, normal, texture coords) at the bound GL_ARRAY_BUFFER
+inline void SetVertexAttributes(VertexFormat format)
+{
+	if (format == VertexFormat::Packed)
+	{
+		//Positions, 0..1 within the bounds
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)0);
+
+		//Normals, -1..1
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+
+		//Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+	}
+	else
+	{
+		//Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+		//Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+		//Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+	}
+}
@@ -0,0 +1,718 @@
+#include "VirtualTexture.h"
+#include "GLState.h"
+#include "ImageDecoder.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "TextureCompressor.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+//Cooked tile file layout
+//	CookedTilesHeader
+//	Tiles of level 0, row by row, then level 1... (16 byte aligned, TileBytes each)
+namespace
+{
+	const uint32_t COOKED_MAGIC = 0x54564C44; //"LDVT"
+	const uint32_t COOKED_VERSION = 1;
+	const uint64_t COOKED_ALIGN = 16;
+
+	struct CookedTilesHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t width;
+		uint32_t height;
+		uint32_t pagesX;
+		uint32_t pagesY;
+		uint32_t levelCount;
+		uint32_t tileBytes;
+	};
+
+	uint64_t DataOffset()
+	{
+		return (sizeof(CookedTilesHeader) + COOKED_ALIGN - 1) & ~(COOKED_ALIGN - 1);
+	}
+
+	std::string CookedPath(const std::string& sourcePath)
+	{
+		return sourcePath + ".vt.cooked";
+	}
+
+	unsigned int NextPowerOfTwo(unsigned int value)
+	{
+		unsigned int power = 1;
+		while (power < value)
+			power *= 2;
+		return power;
+	}
+
+	int Wrap(int value, int size)
+	{
+		return ((value % size) + size) % size;
+	}
+
+	//Page table texel: atlas slot x, y and the level the tile belongs to
+	uint32_t PackEntry(unsigned int x, unsigned int y, unsigned int level)
+	{
+		return x | (y << 8) | (level << 16) | (255u << 24);
+	}
+}
+
+VirtualTextureSystem& VirtualTextureSystem::Get()
+{
+	static VirtualTextureSystem system;
+	return system;
+}
+
+VirtualTextureSystem::VirtualTextureSystem() : _atlas(0), _frame(0), _framebuffer(0), _colour(0), _depth(0), _feedbackWidth(0), _feedbackHeight(0),
+	_nextRead(0), _inFeedback(false), _uploads(0), _evictions(0), _dropped(0), _pendingLoads(0)
+{
+	for (unsigned int i = 0; i < FEEDBACK_BUFFERS; i++)
+	{
+		_readBuffers[i] = 0;
+		_readFences[i] = 0;
+		_readSizes[i][0] = _readSizes[i][1] = 0;
+	}
+	for (unsigned int i = 0; i < 4; i++)
+		_viewport[i] = 0;
+
+	//Tile loads run on the decoder's workers, make sure it outlives this
+	ImageDecoder::Get();
+}
+
+VirtualTextureSystem::~VirtualTextureSystem()
+{
+	//The decoder outlives this, so copies still running would push into a destroyed queue
+	//and read from unmapped files
+	{
+		std::unique_lock<std::mutex> lock(_pendingMutex);
+		_loadsDone.wait(lock, [this] { return _pendingLoads == 0; });
+	}
+
+	//GL objects are left to the context, which is gone by the time statics are destroyed
+	TileLoad* tile = nullptr;
+	while (_loaded.TryPop(tile))
+		delete tile;
+}
+
+void VirtualTextureSystem::initialise()
+{
+	//Physical tile cache
+	unsigned int atlasSize = PHYSICAL_TILES * TILE_STRIDE;
+	glGenTextures(1, &_atlas);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, _atlas);
+	glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, atlasSize, atlasSize, 0, (GLsizei)((atlasSize / 4) * (atlasSize / 4) * 8), NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	//Slot 0 is a grey stand-in for images that are still cooking
+	std::vector<unsigned char> grey(TileBytes());
+	for (size_t i = 0; i < grey.size(); i += 8)
+	{
+		const uint16_t colour = (16 << 11) | (32 << 5) | 16;
+		grey[i + 0] = grey[i + 2] = (unsigned char)(colour & 0xFF);
+		grey[i + 1] = grey[i + 3] = (unsigned char)(colour >> 8);
+	}
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILE_STRIDE, TILE_STRIDE, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, (GLsizei)grey.size(), grey.data());
+	GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+
+	_slots.resize(PHYSICAL_TILES * PHYSICAL_TILES);
+	for (unsigned int i = 0; i < _slots.size(); i++)
+	{
+		Slot& slot = _slots[i];
+		slot.texture = 0;
+		slot.level = slot.x = slot.y = 0;
+		slot.pinned = i == 0;
+		slot.lastFrame = 0;
+		slot.lru = _lru.end();
+	}
+	for (unsigned int i = (unsigned int)_slots.size() - 1; i > 0; i--)
+		_freeSlots.push_back(i);
+}
+
+void VirtualTextureSystem::Layout(unsigned int width, unsigned int height, unsigned int& pagesX, unsigned int& pagesY, unsigned int& levelCount)
+{
+	pagesX = NextPowerOfTwo((width + TILE_SIZE - 1) / TILE_SIZE);
+	pagesY = NextPowerOfTwo((height + TILE_SIZE - 1) / TILE_SIZE);
+
+	//Down to the level where the shorter side is one page, so every level copies texels 1:1
+	levelCount = 1;
+	while ((std::min(pagesX, pagesY) >> levelCount) > 0)
+		levelCount++;
+}
+
+unsigned int VirtualTextureSystem::Acquire(const std::string& path)
+{
+	if (_atlas == 0)
+		initialise();
+
+	std::string key = TextureCache::Canonicalize(path);
+	for (unsigned int i = 0; i < _textures.size(); i++)
+	{
+		if (_textures[i]->path == key)
+			return i + 1;
+	}
+	if (_textures.size() >= 255)
+	{
+		std::cout << "Too many virtual textures, not loading " << path << std::endl;
+		return 0;
+	}
+
+	std::unique_ptr<VirtualTexture> texture(new VirtualTexture());
+	texture->path = key;
+	texture->state = Cooking;
+	texture->rootRequested = false;
+	texture->dirty = true;
+
+	//Only the header, the pixels are read by the cook
+	int width = 0, height = 0, channels = 0;
+	if (!stbi_info(path.c_str(), &width, &height, &channels))
+	{
+		std::cout << "Failed to load virtual texture: " << path << std::endl;
+		width = height = TILE_SIZE;
+		texture->state = Failed;
+	}
+	texture->width = (unsigned int)width;
+	texture->height = (unsigned int)height;
+
+	unsigned int levelCount;
+	Layout(texture->width, texture->height, texture->pagesX, texture->pagesY, levelCount);
+	glGenTextures(1, &texture->pageTable);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, texture->pageTable);
+	for (unsigned int l = 0; l < levelCount; l++)
+	{
+		Level level;
+		level.pagesX = texture->pagesX >> l;
+		level.pagesY = texture->pagesY >> l;
+		level.slots.assign(level.pagesX * level.pagesY, -1);
+		level.entries.resize(level.pagesX * level.pagesY);
+		texture->levels.push_back(level);
+		glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, level.pagesX, level.pagesY, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	rebuildPageTable(*texture);
+
+	VirtualTexture* cooking = texture.get();
+	_textures.push_back(std::move(texture));
+	if (cooking->state == Failed)
+		return (unsigned int)_textures.size();
+
+	std::string source = path;
+	ImageDecoder::Get().Submit([cooking, source]
+	{
+		uint64_t sourceHash = 0;
+		std::string cookedPath = CookedPath(source);
+		bool ready = MeshCache::HashFile(source, sourceHash) &&
+			(OpenCooked(cookedPath, sourceHash, cooking->width, cooking->height, cooking->tiles) ||
+			(Cook(source, cookedPath, sourceHash) && OpenCooked(cookedPath, sourceHash, cooking->width, cooking->height, cooking->tiles)));
+		if (!ready)
+			std::cout << "Failed to cook virtual texture: " << source << std::endl;
+		cooking->state = ready ? Ready : Failed;
+	});
+	return (unsigned int)_textures.size();
+}
+
+void VirtualTextureSystem::Bind(unsigned int id, const Shader& shader, unsigned int unit)
+{
+	if (id == 0 || id > _textures.size())
+		return;
+
+	const VirtualTexture& texture = *_textures[id - 1];
+	GLState::Get().BindTexture(PHYSICAL_UNIT, GL_TEXTURE_2D, _atlas);
+	GLState::Get().BindTexture(unit, GL_TEXTURE_2D, texture.pageTable);
+
+	glm::vec2 virtualSize((float)(texture.pagesX * TILE_SIZE), (float)(texture.pagesY * TILE_SIZE));
+	shader.setInt("vtPageTable"_u, unit);
+	shader.setInt("vtPhysical"_u, PHYSICAL_UNIT);
+	shader.setVec2("vtSize"_u, virtualSize);
+	shader.setVec2("vtScale"_u, glm::vec2(texture.width, texture.height) / virtualSize);
+	shader.setFloat("vtMaxLevel"_u, (float)(texture.levels.size() - 1));
+	shader.setFloat("vtAtlasSize"_u, (float)(PHYSICAL_TILES * TILE_STRIDE));
+	shader.setInt("vtId"_u, id);
+
+	//The feedback target is smaller, so its derivatives ask for coarser levels than the screen
+	shader.setFloat("vtFeedbackBias"_u, _inFeedback ? std::log2((float)FEEDBACK_DIVISOR) : 0.0f);
+}
+
+void VirtualTextureSystem::BeginFeedback(unsigned int width, unsigned int height)
+{
+	if (_atlas == 0)
+		return;
+
+	unsigned int feedbackWidth = std::max(1u, width / FEEDBACK_DIVISOR);
+	unsigned int feedbackHeight = std::max(1u, height / FEEDBACK_DIVISOR);
+	if (feedbackWidth != _feedbackWidth || feedbackHeight != _feedbackHeight)
+	{
+		_feedbackWidth = feedbackWidth;
+		_feedbackHeight = feedbackHeight;
+		if (_framebuffer == 0)
+		{
+			glGenFramebuffers(1, &_framebuffer);
+			glGenTextures(1, &_colour);
+			glGenRenderbuffers(1, &_depth);
+			glGenBuffers(FEEDBACK_BUFFERS, _readBuffers);
+		}
+
+		GLState::Get().BindTexture(GL_TEXTURE_2D, _colour);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedbackWidth, feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+		glBindRenderbuffer(GL_RENDERBUFFER, _depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colour, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Virtual texture feedback framebuffer is incomplete" << std::endl;
+
+		for (unsigned int i = 0; i < FEEDBACK_BUFFERS; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, _readBuffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+			if (_readFences[i])
+			{
+				glDeleteSync(_readFences[i]);
+				_readFences[i] = 0;
+			}
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	glGetIntegerv(GL_VIEWPORT, _viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+	glViewport(0, 0, feedbackWidth, feedbackHeight);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f); //Id 0, no request
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	_inFeedback = true;
+}
+
+void VirtualTextureSystem::EndFeedback()
+{
+	if (!_inFeedback)
+		return;
+
+	//Read back into a pixel pack buffer, mapped a frame or two later once its fence passes
+	unsigned int index = _nextRead;
+	if (_readFences[index])
+		glDeleteSync(_readFences[index]);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _readBuffers[index]);
+	glReadPixels(0, 0, _feedbackWidth, _feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	_readFences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	_readSizes[index][0] = _feedbackWidth;
+	_readSizes[index][1] = _feedbackHeight;
+	_nextRead = (_nextRead + 1) % FEEDBACK_BUFFERS;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+	_inFeedback = false;
+}
+
+void VirtualTextureSystem::Update()
+{
+	if (_atlas == 0)
+		return;
+	_frame++;
+
+	//The coarsest level of every newly cooked image stays resident as the last fallback
+	for (unsigned int i = 0; i < _textures.size(); i++)
+	{
+		VirtualTexture& texture = *_textures[i];
+		if (texture.rootRequested || texture.state != Ready)
+			continue;
+		texture.rootRequested = true;
+		const Level& root = texture.levels.back();
+		for (unsigned int y = 0; y < root.pagesY; y++)
+		{
+			for (unsigned int x = 0; x < root.pagesX; x++)
+				load(TileKey(i + 1, (unsigned int)texture.levels.size() - 1, x, y));
+		}
+	}
+
+	readFeedback();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	GLState::Get().BindTexture(GL_TEXTURE_2D, _atlas);
+	TileLoad* tile = nullptr;
+	for (unsigned int i = 0; i < MAX_UPLOADS && _loaded.TryPop(tile); i++)
+	{
+		upload(tile);
+		delete tile;
+	}
+
+	for (unsigned int i = 0; i < _textures.size(); i++)
+	{
+		if (_textures[i]->dirty)
+			rebuildPageTable(*_textures[i]);
+	}
+}
+
+void VirtualTextureSystem::readFeedback()
+{
+	//Newest read back whose copy has completed, older ones are stale and dropped
+	int ready = -1;
+	for (unsigned int i = 1; i <= FEEDBACK_BUFFERS; i++)
+	{
+		unsigned int index = (_nextRead + FEEDBACK_BUFFERS - i) % FEEDBACK_BUFFERS;
+		if (!_readFences[index])
+			continue;
+		if (ready >= 0)
+		{
+			glDeleteSync(_readFences[index]);
+			_readFences[index] = 0;
+			continue;
+		}
+		GLenum status = glClientWaitSync(_readFences[index], 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+			ready = (int)index;
+	}
+	if (ready < 0)
+		return;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _readBuffers[ready]);
+	size_t pixelCount = (size_t)_readSizes[ready][0] * _readSizes[ready][1];
+	const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 4, GL_MAP_READ_BIT);
+	std::vector<uint64_t> missing;
+	if (pixels)
+	{
+		std::unordered_set<uint64_t> seen;
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			const unsigned char* pixel = pixels + i * 4;
+			if (pixel[3] == 0 || pixel[3] > _textures.size())
+				continue;
+			uint64_t key = TileKey(pixel[3], pixel[2], pixel[0], pixel[1]);
+			if (seen.insert(key).second)
+				request(pixel[3], pixel[2], pixel[0], pixel[1], missing);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteSync(_readFences[ready]);
+	_readFences[ready] = 0;
+
+	//Coarse tiles first, they stand in for everything below them
+	std::sort(missing.begin(), missing.end());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+	std::stable_sort(missing.begin(), missing.end(), [](uint64_t a, uint64_t b) { return ((a >> 40) & 0xFF) > ((b >> 40) & 0xFF); });
+	for (unsigned int i = 0; i < missing.size(); i++)
+	{
+		if (_loading.size() >= MAX_LOADS)
+		{
+			_dropped += (unsigned int)(missing.size() - i);
+			break;
+		}
+		load(missing[i]);
+	}
+}
+
+//Marks the tile the page resolves to as seen and collects every missing tile between it and the page
+void VirtualTextureSystem::request(unsigned int id, unsigned int level, unsigned int x, unsigned int y, std::vector<uint64_t>& missing)
+{
+	VirtualTexture& texture = *_textures[id - 1];
+	if (texture.state != Ready || level >= texture.levels.size())
+		return;
+
+	for (unsigned int l = level; l < texture.levels.size(); l++, x /= 2, y /= 2)
+	{
+		const Level& info = texture.levels[l];
+		if (x >= info.pagesX || y >= info.pagesY)
+			return;
+		int slot = info.slots[y * info.pagesX + x];
+		if (slot >= 0)
+		{
+			touch((unsigned int)slot);
+			return;
+		}
+		uint64_t key = TileKey(id, l, x, y);
+		if (_loading.find(key) == _loading.end())
+			missing.push_back(key);
+	}
+}
+
+void VirtualTextureSystem::touch(unsigned int slot)
+{
+	Slot& info = _slots[slot];
+	info.lastFrame = _frame;
+	if (!info.pinned)
+		_lru.splice(_lru.end(), _lru, info.lru);
+}
+
+//Copies the tile out of the mapped file on a decode worker, so page faults never stall the render thread
+void VirtualTextureSystem::load(uint64_t key)
+{
+	if (!_loading.insert(key).second)
+		return;
+
+	TileLoad* tile = new TileLoad();
+	tile->texture = (unsigned int)(key >> 48);
+	tile->level = (unsigned int)(key >> 40) & 0xFF;
+	tile->y = (unsigned int)(key >> 20) & 0xFFFFF;
+	tile->x = (unsigned int)key & 0xFFFFF;
+
+	const VirtualTexture& texture = *_textures[tile->texture - 1];
+	size_t index = 0;
+	for (unsigned int l = 0; l < tile->level; l++)
+		index += texture.levels[l].pagesX * texture.levels[l].pagesY;
+	index += tile->y * texture.levels[tile->level].pagesX + tile->x;
+	const unsigned char* source = texture.tiles.GetData() + DataOffset() + index * TileBytes();
+
+	{
+		std::lock_guard<std::mutex> lock(_pendingMutex);
+		_pendingLoads++;
+	}
+	ImageDecoder::Get().Submit([this, tile, source]
+	{
+		tile->blocks.assign(source, source + TileBytes());
+		_loaded.Push(tile);
+		{
+			std::lock_guard<std::mutex> lock(_pendingMutex);
+			_pendingLoads--;
+		}
+		_loadsDone.notify_one();
+	});
+}
+
+void VirtualTextureSystem::upload(TileLoad* tile)
+{
+	_loading.erase(TileKey(tile->texture, tile->level, tile->x, tile->y));
+	VirtualTexture& texture = *_textures[tile->texture - 1];
+	Level& level = texture.levels[tile->level];
+	int& page = level.slots[tile->y * level.pagesX + tile->x];
+	if (page >= 0)
+		return;
+
+	unsigned int slot;
+	if (!allocateSlot(slot))
+	{
+		_dropped++;
+		return;
+	}
+
+	unsigned int slotX = slot % PHYSICAL_TILES;
+	unsigned int slotY = slot / PHYSICAL_TILES;
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, slotX * TILE_STRIDE, slotY * TILE_STRIDE, TILE_STRIDE, TILE_STRIDE,
+		GL_COMPRESSED_RGB_S3TC_DXT1_EXT, (GLsizei)tile->blocks.size(), tile->blocks.data());
+
+	Slot& info = _slots[slot];
+	info.texture = tile->texture;
+	info.level = tile->level;
+	info.x = tile->x;
+	info.y = tile->y;
+	info.pinned = tile->level == texture.levels.size() - 1;
+	info.lastFrame = _frame;
+	info.lru = info.pinned ? _lru.end() : _lru.insert(_lru.end(), slot);
+	page = (int)slot;
+	texture.dirty = true;
+	_uploads++;
+}
+
+//A free slot, or the least recently seen one unless it was still in use last frame
+bool VirtualTextureSystem::allocateSlot(unsigned int& slot)
+{
+	if (!_freeSlots.empty())
+	{
+		slot = _freeSlots.back();
+		_freeSlots.pop_back();
+		return true;
+	}
+	if (_lru.empty() || _slots[_lru.front()].lastFrame + 1 >= _frame)
+		return false;
+
+	slot = _lru.front();
+	_lru.pop_front();
+	Slot& info = _slots[slot];
+	VirtualTexture& owner = *_textures[info.texture - 1];
+	Level& level = owner.levels[info.level];
+	level.slots[info.y * level.pagesX + info.x] = -1;
+	owner.dirty = true;
+	info.texture = 0;
+	info.lru = _lru.end();
+	_evictions++;
+	return true;
+}
+
+//Every page points at its own tile when resident, else at its parent's entry
+void VirtualTextureSystem::rebuildPageTable(VirtualTexture& texture)
+{
+	GLState::Get().BindTexture(GL_TEXTURE_2D, texture.pageTable);
+	unsigned int top = (unsigned int)texture.levels.size() - 1;
+	for (int l = (int)top; l >= 0; l--)
+	{
+		Level& level = texture.levels[l];
+		for (unsigned int y = 0; y < level.pagesY; y++)
+		{
+			for (unsigned int x = 0; x < level.pagesX; x++)
+			{
+				unsigned int index = y * level.pagesX + x;
+				int slot = level.slots[index];
+				if (slot >= 0)
+					level.entries[index] = PackEntry(slot % PHYSICAL_TILES, slot / PHYSICAL_TILES, l);
+				else if ((unsigned int)l == top)
+					level.entries[index] = PackEntry(0, 0, top); //Grey stand-in
+				else
+				{
+					const Level& parent = texture.levels[l + 1];
+					level.entries[index] = parent.entries[(y / 2) * parent.pagesX + x / 2];
+				}
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, level.pagesX, level.pagesY, GL_RGBA, GL_UNSIGNED_BYTE, level.entries.data());
+	}
+	texture.dirty = false;
+}
+
+void VirtualTextureSystem::PrintStats() const
+{
+	unsigned int resident = (unsigned int)(_slots.size() - _freeSlots.size());
+	unsigned int atlasSize = PHYSICAL_TILES * TILE_STRIDE;
+	std::cout << "Virtual textures: " << _textures.size() << " images, " << (resident > 0 ? resident - 1 : 0) << "/" << (_slots.size() > 0 ? _slots.size() - 1 : 0)
+		<< " tiles resident in a " << (atlasSize / 4) * (atlasSize / 4) * 8 / 1024 << " KB atlas, " << _uploads << " uploaded, " << _evictions << " evicted, "
+		<< _dropped << " requests deferred" << std::endl;
+}
+
+bool VirtualTextureSystem::OpenCooked(const std::string& cookedPath, uint64_t sourceHash, unsigned int width, unsigned int height, MappedFile& file)
+{
+	if (!file.Open(cookedPath))
+		return false;
+
+	unsigned int pagesX, pagesY, levelCount;
+	Layout(width, height, pagesX, pagesY, levelCount);
+	uint64_t tileCount = 0;
+	for (unsigned int l = 0; l < levelCount; l++)
+		tileCount += (uint64_t)(pagesX >> l) * (pagesY >> l);
+
+	CookedTilesHeader header;
+	if (file.GetSize() < sizeof(header))
+	{
+		file.Close();
+		return false;
+	}
+	std::memcpy(&header, file.GetData(), sizeof(header));
+	if (header.magic != COOKED_MAGIC || header.version != COOKED_VERSION || header.sourceHash != sourceHash || header.width != width || header.height != height ||
+		header.pagesX != pagesX || header.pagesY != pagesY || header.levelCount != levelCount || header.tileBytes != TileBytes() ||
+		file.GetSize() < DataOffset() + tileCount * TileBytes())
+	{
+		file.Close();
+		return false;
+	}
+	return true;
+}
+
+//Pads the image to whole power of two pages by repeating it, then writes every level's tiles with
+//their borders taken from the neighbouring texels (wrapping, the maps tile horizontally)
+bool VirtualTextureSystem::Cook(const std::string& path, const std::string& cookedPath, uint64_t sourceHash)
+{
+	DecodeOptions options;
+	options.channels = 4;
+	DecodedImage image;
+	if (!ImageDecoder::Decode(path, options, image))
+		return false;
+
+	CookedTilesHeader header;
+	header.magic = COOKED_MAGIC;
+	header.version = COOKED_VERSION;
+	header.sourceHash = sourceHash;
+	header.width = (uint32_t)image.width;
+	header.height = (uint32_t)image.height;
+	Layout(header.width, header.height, header.pagesX, header.pagesY, header.levelCount);
+	header.tileBytes = (uint32_t)TileBytes();
+
+	unsigned int levelWidth = header.pagesX * TILE_SIZE;
+	unsigned int levelHeight = header.pagesY * TILE_SIZE;
+	std::vector<unsigned char> level((size_t)levelWidth * levelHeight * 4);
+	for (unsigned int y = 0; y < levelHeight; y++)
+	{
+		for (unsigned int x = 0; x < levelWidth; x++)
+			std::memcpy(&level[((size_t)y * levelWidth + x) * 4], image.pixels + ((size_t)(y % image.height) * image.width + x % image.width) * 4, 4);
+	}
+	image.Free();
+
+	std::ofstream out(cookedPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "Failed to write cooked virtual texture: " << cookedPath << std::endl;
+		return false;
+	}
+	static const char padding[COOKED_ALIGN] = {};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(padding, (std::streamsize)(DataOffset() - sizeof(header)));
+
+	const unsigned int blocks = TILE_STRIDE / 4;
+	std::vector<unsigned char> tile(TileBytes());
+	std::vector<unsigned char> next;
+	for (unsigned int l = 0; l < header.levelCount; l++)
+	{
+		for (unsigned int pageY = 0; pageY < (header.pagesY >> l); pageY++)
+		{
+			for (unsigned int pageX = 0; pageX < (header.pagesX >> l); pageX++)
+			{
+				int originX = (int)(pageX * TILE_SIZE) - (int)TILE_BORDER;
+				int originY = (int)(pageY * TILE_SIZE) - (int)TILE_BORDER;
+				for (unsigned int by = 0; by < blocks; by++)
+				{
+					for (unsigned int bx = 0; bx < blocks; bx++)
+					{
+						unsigned char texels[16 * 4];
+						for (int y = 0; y < 4; y++)
+						{
+							int sy = Wrap(originY + (int)by * 4 + y, (int)levelHeight);
+							for (int x = 0; x < 4; x++)
+							{
+								int sx = Wrap(originX + (int)bx * 4 + x, (int)levelWidth);
+								std::memcpy(texels + (y * 4 + x) * 4, &level[((size_t)sy * levelWidth + sx) * 4], 4);
+							}
+						}
+						TextureCompressor::EncodeBC1(texels, &tile[(by * blocks + bx) * 8]);
+					}
+				}
+				out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+			}
+		}
+
+		//Box filter down, the padded sizes are powers of two
+		if (l + 1 < header.levelCount)
+		{
+			unsigned int nextWidth = levelWidth / 2, nextHeight = levelHeight / 2;
+			next.resize((size_t)nextWidth * nextHeight * 4);
+			for (unsigned int y = 0; y < nextHeight; y++)
+			{
+				for (unsigned int x = 0; x < nextWidth; x++)
+				{
+					const unsigned char* a = &level[((size_t)(y * 2) * levelWidth + x * 2) * 4];
+					const unsigned char* b = a + (size_t)levelWidth * 4;
+					unsigned char* target = &next[((size_t)y * nextWidth + x) * 4];
+					for (int c = 0; c < 4; c++)
+						target[c] = (unsigned char)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) / 4);
+				}
+			}
+			level.swap(next);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+	}
+
+	if (!out)
+	{
+		std::cout << "Failed to write cooked virtual texture: " << cookedPath << std::endl;
+		out.close();
+		std::remove(cookedPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <glad/include/glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "MappedFile.h"
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//Tile based virtual texturing for large surface maps on plain GL 3.3.
+//Every image is cooked once into 128x128 BC1 tiles (plus a 4 texel border for filtering) for
+//each level of its mip pyramid. Only the tiles the camera needs live in one fixed size
+//physical atlas, so memory stays the same however many maps are added. A page table texture
+//per image (one texel per tile, one mip per level) maps virtual tiles to atlas slots, falling
+//back to the nearest resident coarser tile. Which tiles are needed comes from a low resolution
+//feedback pass read back asynchronously, missing tiles are loaded on the ImageDecoder pool and
+//the least recently seen tiles are evicted when the atlas is full.
+//Draw with Shaders/VirtualTexture.fs, and Shaders/VirtualFeedback.fs between BeginFeedback and
+//EndFeedback.
+class VirtualTextureSystem
+{
+public:
+	static const unsigned int TILE_SIZE = 128;
+	static const unsigned int TILE_BORDER = 4;
+	static const unsigned int TILE_STRIDE = TILE_SIZE + 2 * TILE_BORDER;
+	static const unsigned int PHYSICAL_TILES = 24; //Per side, 576 slots of BC1 is 5 MB
+	static const unsigned int PHYSICAL_UNIT = 15; //Texture unit the atlas is bound to
+	static const unsigned int FEEDBACK_DIVISOR = 4; //Feedback pass resolution
+	static const unsigned int MAX_UPLOADS = 16; //Tiles per frame
+	static const unsigned int MAX_LOADS = 64; //Tiles being read at once
+
+	static VirtualTextureSystem& Get();
+
+	//GL thread: virtual texture for the image at path, cooked into tiles in the background
+	unsigned int Acquire(const std::string& path);
+
+	//Binds id's page table to unit and the atlas to PHYSICAL_UNIT, and sets the sampling uniforms
+	void Bind(unsigned int id, const Shader& shader, unsigned int unit);
+
+	//Draw every virtually textured model with the feedback shader in between
+	void BeginFeedback(unsigned int width, unsigned int height);
+	void EndFeedback();
+
+	//GL thread, once per frame: reads back feedback, streams tiles and updates page tables
+	void Update();
+
+	void PrintStats() const;
+
+private:
+	VirtualTextureSystem();
+	~VirtualTextureSystem();
+	VirtualTextureSystem(const VirtualTextureSystem&) = delete;
+	VirtualTextureSystem& operator=(const VirtualTextureSystem&) = delete;
+
+	struct Level
+	{
+		unsigned int pagesX, pagesY;
+		std::vector<int> slots; //Atlas slot per page, -1 when not resident
+		std::vector<uint32_t> entries; //Page table texels
+	};
+
+	struct VirtualTexture
+	{
+		std::string path;
+		unsigned int width, height; //Image
+		unsigned int pagesX, pagesY; //Level 0, rounded up to powers of two
+		std::vector<Level> levels;
+		unsigned int pageTable;
+		bool dirty;
+
+		MappedFile tiles; //Cooked tiles, mapped once state is Ready
+		std::atomic<int> state;
+		bool rootRequested; //Coarsest level, kept resident
+	};
+
+	enum CookState
+	{
+		Cooking,
+		Ready,
+		Failed
+	};
+
+	struct Slot
+	{
+		unsigned int texture; //0 when free
+		unsigned int level, x, y;
+		bool pinned;
+		unsigned int lastFrame;
+		std::list<unsigned int>::iterator lru;
+	};
+
+	struct TileLoad
+	{
+		unsigned int texture;
+		unsigned int level, x, y;
+		std::vector<unsigned char> blocks;
+	};
+
+	std::vector<std::unique_ptr<VirtualTexture>> _textures; //id - 1
+	std::vector<Slot> _slots;
+	std::list<unsigned int> _lru; //Least recently seen first
+	std::vector<unsigned int> _freeSlots;
+	std::unordered_set<uint64_t> _loading;
+	LockFreeQueue<TileLoad*> _loaded;
+	unsigned int _atlas;
+	unsigned int _frame;
+
+	//Feedback target and read back ring
+	static const unsigned int FEEDBACK_BUFFERS = 2;
+	unsigned int _framebuffer, _colour, _depth;
+	unsigned int _feedbackWidth, _feedbackHeight;
+	unsigned int _readBuffers[FEEDBACK_BUFFERS];
+	GLsync _readFences[FEEDBACK_BUFFERS];
+	unsigned int _readSizes[FEEDBACK_BUFFERS][2];
+	unsigned int _nextRead;
+	bool _inFeedback;
+	int _viewport[4];
+
+	//Stats
+	unsigned int _uploads, _evictions, _dropped;
+
+	//Tile copies still on a decode worker, the destructor waits for them
+	unsigned int _pendingLoads;
+	std::mutex _pendingMutex;
+	std::condition_variable _loadsDone;
+
+	void initialise();
+	void readFeedback();
+	void request(unsigned int id, unsigned int level, unsigned int x, unsigned int y, std::vector<uint64_t>& missing);
+	void load(uint64_t key);
+	void upload(TileLoad* tile);
+	bool allocateSlot(unsigned int& slot);
+	void rebuildPageTable(VirtualTexture& texture);
+	void touch(unsigned int slot);
+
+	static uint64_t TileKey(unsigned int id, unsigned int level, unsigned int x, unsigned int y)
+	{
+		return ((uint64_t)id << 48) | ((uint64_t)level << 40) | ((uint64_t)y << 20) | x;
+	}
+	static size_t TileBytes() { return (TILE_STRIDE / 4) * (TILE_STRIDE / 4) * 8; }
+	static void Layout(unsigned int width, unsigned int height, unsigned int& pagesX, unsigned int& pagesY, unsigned int& levelCount);
+	static bool OpenCooked(const std::string& cookedPath, uint64_t sourceHash, unsigned int width, unsigned int height, MappedFile& file);
+	static bool Cook(const std::string& path, const std::string& cookedPath, uint64_t sourceHash);
+};
@@ -20,9 +20,15 @@
 
 //Internal includes
 #include "Shader.h"
+#include "ShaderPermutations.h"
+#include "GLState.h"
+#include "InstanceCuller.h"
+#include "GpuInstanceCuller.h"
+#include "AsteroidInstance.h"
 #include "Texture2D.h"
 #include "Camera.h"
 #include "Model.h"
+#include "ModelLoader.h"
 
 //Callbacks and Functions
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -31,9 +37,8 @@ int shipMovement(GLFWwindow* window);
 int updatePlanetCam(GLFWwindow* window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void setStaticLights(Shader shader);
-void setSpotlight(Shader shader);
-void RenderText(Shader shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
+LightsBlock sceneLights();
+void RenderText(const Shader& shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
 
 //Window settings
 const unsigned int SCR_WIDTH = 800;
@@ -60,6 +65,12 @@ glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
 bool space = true;
 
+//Asteroid culling on the GPU (GpuInstanceCuller) or the CPU (InstanceCuller), G switches when supported
+bool useGpuCulling = true;
+bool gpuCullingKeyDown = false;
+const float ASTEROID_DRAW_DISTANCE = 60000.0f;
+const float ASTEROID_ORBIT_SPEED = 0.01f; //Radians a second
+
 float skyboxVertices[] = {
     // positions          
     -1.0f,  1.0f, -1.0f,
@@ -136,8 +147,15 @@ std::map<GLchar, Character> Characters;
 GLuint textVAO, textVBO;
 
 
-int main()
+int main(int argc, char** argv)
 {
+    //"--benchmark-obj" times the OBJ parser against Assimp on the bundled models and exits
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-obj")
+    {
+        std::vector<std::string> paths = { "Models/planet/planet.obj", "Models/rock/rock.obj", "Models/asteroid_OBJ/asteroid OBJ.obj" };
+        return ObjParser::Benchmark(paths) ? 0 : 1;
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -166,6 +184,7 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    ShaderCache::Get().Initialise((GLADloadproc)glfwGetProcAddress);
 
     //Freetype
     FT_Library ft;
@@ -197,7 +216,7 @@ int main()
         //Generate texture
         GLuint texture;
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        GLState::Get().BindTexture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, face->glyph->bitmap.width, face->glyph->bitmap.rows, 0, GL_RED, GL_UNSIGNED_BYTE, face->glyph->bitmap.buffer);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -208,37 +227,37 @@ int main()
         Character character = { texture, glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows), glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top), face->glyph->advance.x };
         Characters.insert(std::pair<GLchar, Character>(c, character));
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
     FT_Done_Face(face);
     FT_Done_FreeType(ft);
 
    
     glGenVertexArrays(1, &textVAO);
     glGenBuffers(1, &textVBO);
-    glBindVertexArray(textVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, textVBO);
+    GLState::Get().BindVertexArray(textVAO);
+    GLState::Get().BindArrayBuffer(textVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLState::Get().BindArrayBuffer(0);
+    GLState::Get().BindVertexArray(0);
 
 
 
     glm::mat4 textProjection = glm::ortho(0.0f, static_cast<GLfloat>(SCR_WIDTH), 0.0f, static_cast<GLfloat>(SCR_HEIGHT));
 
     //States
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_CULL_FACE);
+    GLState::Get().Enable(GL_DEPTH_TEST);
+    GLState::Get().Enable(GL_BLEND);
+    GLState::Get().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::Get().Enable(GL_CULL_FACE);
 
     //Skybox Array
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    GLState::Get().BindVertexArray(skyboxVAO);
+    GLState::Get().BindArrayBuffer(skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
@@ -248,108 +267,134 @@ int main()
     skyboxTexture->LoadCubeMap(faces);
 
     //Shaders
-    Shader gasShader("Shaders/Model2.vs", "Shaders/Model2.fs");
-    Shader modelShader("Shaders/Model2.vs", "Shaders/Model2.fs");
-    Shader lightModelShader("Shaders/model.vs", "Shaders/model.fs");
+    Shader lightModelShader("Shaders/model.vs", "Shaders/VirtualTexture.fs");
     Shader skyboxShader("Shaders/Skybox.vs", "Shaders/Skybox.fs");
-    Shader earthShader("Shaders/Model2.vs", "Shaders/Model2.fs");
-    Shader redShader("Shaders/Model2.vs", "Shaders/Model2.fs");
-    Shader alienShader("Shaders/Model2.vs", "Shaders/Model2.fs");
-    Shader sednaShader("Shaders/Model2.vs", "Shaders/Model2.fs");
     Shader textShader("Shaders/Text.vs", "Shaders/Text.fs");
     Shader asteroidShader("Shaders/Asteroid.vs", "Shaders/Asteroid.fs");
-    Shader asteroidPlanetShader("Shaders/model.vs", "Shaders/model.fs");
+    Shader asteroidPlanetShader("Shaders/model.vs", "Shaders/VirtualTexture.fs");
+    Shader vtFeedbackShader("Shaders/model.vs", "Shaders/VirtualFeedback.fs");
+
+    //Ship and planets, one Model2 variant per texture set. The planets' map_Bump files are their
+    //colour maps, so normal and height mapping stay off.
+    ShaderPermutations litShaders("Shaders/Model2.vs", "Shaders/Model2.fs", SHADER_SPECULAR_MAP | SHADER_UNLIT, [](const Shader& shader)
+    {
+        //Material constants, camera and lights come from FrameUniforms each frame
+        shader.setFloat("material.shininess"_u, 32.0f);
+    });
+    litShaders.Prepare(0);
+
+    //The shaders compile while the models load, nothing uses them before that finishes
+
+    //Models (imported on the worker pool, uploaded here)
+    Model sunModel;
+    Model starDestroyerModel;
+    Model gasModel;
+    Model earthModel;
+    Model redModel;
+    Model alienModel;
+    Model sednaModel;
+    Model asteroidModel;
+    Model iceModel;
+
+    //Large surface maps are streamed as tiles
+    sunModel.virtualTexturing = true;
+    iceModel.virtualTexturing = true;
+
+    //Only maps the shaders drawing each model sample are loaded
+    Model* litModels[] = { &starDestroyerModel, &gasModel, &earthModel, &redModel, &alienModel, &sednaModel };
+    for (Model* litModel : litModels)
+        litModel->shaderFeatures = litShaders.GetSupported();
+    asteroidModel.shaderFeatures = 0;
+
+    ModelLoader modelLoader(ThreadPool::Get());
+    modelLoader.Load(sunModel, "Models/planet/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(starDestroyerModel, "Models/Star_Destroyer/star_destroyer.obj");
+    modelLoader.Load(gasModel, "Models/gas planet/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(earthModel, "Models/earth/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(redModel, "Models/red/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(alienModel, "Models/alien/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(sednaModel, "Models/sedna/planet.obj", VertexFormat::Packed);
+    modelLoader.Load(asteroidModel, "Models/rock/rock.obj", VertexFormat::Packed);
+    modelLoader.Load(iceModel, "Models/ice planet/planet.obj", VertexFormat::Packed);
+    while (modelLoader.Update() > 0)
+    {
+        ShaderCache::Get().Poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    GeometryRegistry::Get().PrintStats();
+    GeometryAllocator::Get().PrintStats();
+    VirtualTextureSystem::Get().PrintStats();
 
+    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+    //Skybox
     skyboxShader.use();
-    skyboxShader.setInt("skybox", 0);
-
-    //Models
-    Model sunModel((char*)"Models/planet/planet.obj");
-    Model starDestroyerModel((char*)"Models/Star_Destroyer/star_destroyer.obj");
-    Model gasModel((char*)"Models/gas planet/planet.obj");
-    Model earthModel((char*)"Models/earth/planet.obj");
-    Model redModel((char*)"Models/red/planet.obj");
-    Model alienModel((char*)"Models/alien/planet.obj");
-    Model sednaModel((char*)"Models/sedna/planet.obj");
-    Model asteroidModel((char*)"Models/rock/rock.obj");
-    Model iceModel((char*)"Models/ice planet/planet.obj");
+    skyboxShader.setInt("skybox"_u, 0);
 
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    //Variants for any other texture sets, compiled together
+    for (const Model* litModel : litModels)
+        litModel->PrepareShaders(litShaders);
 
     //Text
     textShader.use();
-    textShader.setMat4("projection", textProjection);
+    textShader.setMat4("projection"_u, textProjection);
 
     //Sun
     lightModelShader.use();
     glm::mat4 model3 = glm::mat4(1.0f);
     model3 = glm::scale(model3, glm::vec3(200.0f, 200.0f, 200.0f));
-    lightModelShader.setMat4("model", model3);
+    lightModelShader.setMat4("model"_u, model3);
 
     //Ship
-    modelShader.use();
     glm::mat4 model2 = glm::mat4(1.0f);
     model2 = glm::translate(model2, glm::vec3(0.0f, -1.75f, 500.0f)); 
     model2 = glm::scale(model2, glm::vec3(0.2f, 0.2f, 0.2f));
-    modelShader.setMat4("model", model2);
 
     glm::vec3 shipCenter = glm::vec3(0.0f, -1.75f, 0.0f);
     float shipRotation = 0.0f;
 
     //Gas Planet
-    gasShader.use();
     model4 = glm::scale(model4, glm::vec3(70.0f, 70.0f, 70.0f));
     model4 = glm::translate(model4, glm::vec3(-100.0f, 0.0f, -100.0f));
-    gasShader.setMat4("model", model4);
 
     //Earth
-    earthShader.use();
     model5 = glm::scale(model5, glm::vec3(80.0f, 80.0f, 80.0f));
     model5 = glm::rotate(model5, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     model5 = glm::translate(model5, glm::vec3(-200.0f, 200.0f, 0.0f));
-    earthShader.setMat4("model", model5);
 
     //Red Planet
-    redShader.use();
     model6 = glm::scale(model6, glm::vec3(50.0f, 50.0f, 50.0f));
     model6 = glm::rotate(model6, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     model6 = glm::translate(model6, glm::vec3(-350.0f, 350.0f, 0.0f));
-    redShader.setMat4("model", model6);
 
     //Alien Planet
-    alienShader.use();
     model7 = glm::scale(model7, glm::vec3(90.0f, 90.0f, 90.0f));
     model7 = glm::translate(model7, glm::vec3(-500.0f, 0.0f, 400.0f));
-    alienShader.setMat4("model", model7);
 
     //Sedna Planet
-    sednaShader.use();
     model8 = glm::scale(model8, glm::vec3(75.0f, 75.0f, 75.0f));
     model8 = glm::translate(model8, glm::vec3(-650.0f, 0.0f, -500.0f));
-    sednaShader.setMat4("model", model8);
 
     //Asteroid and Planet
     //Planet
     asteroidPlanetShader.use();
     model9 = glm::scale(model9, glm::vec3(250.0f, 250.0f, 250.0f));
     //model9 = glm::translate(model9, glm::vec3(384.0f, 0.0f, -80.0f));
-    asteroidPlanetShader.setMat4("model", model9);
+    asteroidPlanetShader.setMat4("model"_u, model9);
+    ShaderCache::Get().PrintStats();
 
+    RenderQueue renderQueue;
 
     //Asteroids
     unsigned int asteroidNum = 50000;
-    glm::mat4* modelMatrices;
-    modelMatrices = new glm::mat4[asteroidNum];
+    std::vector<AsteroidInstance> asteroids(asteroidNum);
+    std::vector<glm::vec4> asteroidSpheres(asteroidNum);
+    float rockRadius = glm::length(asteroidModel.boundsCenter) + asteroidModel.boundsRadius;
     srand(glfwGetTime());
     float radius = 150.0f;
     float offset = 25.0f;
     for (unsigned int i = 0; i < asteroidNum; i++)
     {
-        glm::mat4 model10 = glm::mat4(1.0f);
-        model10 = glm::scale(model10, glm::vec3(80.0f, 80.0f, 80.0f));
-        //model10 = glm::translate(model10, glm::vec3(1200.0f, 0.0f, -250.0f));
-        
         //Displacement
         float angle = (float)i / (float)asteroidNum * 360.0f;
         float displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
@@ -358,60 +403,72 @@ int main()
         float y = displacement * 0.4f; // keep height of asteroid field smaller compared to width of x and z
         displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
         float z = cos(angle) * radius + displacement;
-        model10 = glm::translate(model10, glm::vec3(x, y, z));
 
         //Scale
         float scale = (rand() % 20) / 100.0f + 0.05f;
-        model10 = glm::scale(model10, glm::vec3(scale));
 
-        ////Rotation
-        //float rotAngle = (rand() % 360);
-        //model10 = glm::rotate(model10, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
-
-        //Add to matrix array
-        modelMatrices[i] = model10;
+        //The whole field is scaled by 80, the rotation comes from the seed in the shader
+        uint32_t rotationSeed = ((uint32_t)rand() << 16) ^ (uint32_t)rand() ^ i;
+        asteroids[i] = AsteroidInstance::Make(glm::vec3(x, y, z) * 80.0f, scale * 80.0f, rotationSeed);
+        asteroidSpheres[i] = asteroids[i].GetSphere(rockRadius);
     }
 
-    //Asteroid Instance Array
-    unsigned int asteroidBuffer;
-    glGenBuffers(1, &asteroidBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, asteroidBuffer);
-    glBufferData(GL_ARRAY_BUFFER, asteroidNum * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
+    //Asteroid Instance Array, refilled each frame with the asteroids in view. Culled on the GPU
+    //when the driver can feed the count straight to the draw, otherwise on the CPU.
+    InstanceCuller asteroidCuller(asteroidSpheres.data(), asteroids.data(), asteroidNum, sizeof(AsteroidInstance));
+    GpuInstanceCuller asteroidGpuCuller((GLADloadproc)glfwGetProcAddress, asteroidSpheres.data(), asteroids.data(), asteroidNum);
+    std::vector<AsteroidInstance>().swap(asteroids);
+    std::vector<glm::vec4>().swap(asteroidSpheres);
 
-    for (unsigned int i = 0; i < asteroidModel.meshes.size(); i++)
+    //Own VAO over the shared rock geometry buffers, with the instance attributes added
+    auto createAsteroidVAO = [&](unsigned int asteroidBuffer)
+    {
+        unsigned int asteroidVAO = GeometryAllocator::Get().CreateVertexArray(asteroidModel.meshes[0].geometry->format);
+        GLState::Get().BindVertexArray(asteroidVAO);
+        GLState::Get().BindArrayBuffer(asteroidBuffer);
+        AsteroidInstance::SetupAttributes();
+        GLState::Get().BindVertexArray(0);
+        return asteroidVAO;
+    };
+    unsigned int asteroidVAO = 0;
+    unsigned int asteroidGpuVAO = 0;
+    if (!asteroidModel.meshes.empty())
     {
-        unsigned int asteroidVAO = asteroidModel.meshes[i].VAO;
-        glBindVertexArray(asteroidVAO);
-
-        //Vertex Shader Attributes
-        glEnableVertexAttribArray(3); //Location 3
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-        glVertexAttribDivisor(3, 1);
-        glVertexAttribDivisor(4, 1);
-        glVertexAttribDivisor(5, 1);
-        glVertexAttribDivisor(6, 1);
-
-        glBindVertexArray(0);
+        asteroidVAO = createAsteroidVAO(asteroidCuller.GetBuffer());
+        if (asteroidGpuCuller.IsSupported())
+        {
+            asteroidGpuVAO = createAsteroidVAO(asteroidGpuCuller.GetBuffer());
+            for (unsigned int i = 0; i < asteroidModel.meshes.size(); i++)
+            {
+                const MeshGeometry& rock = *asteroidModel.meshes[i].geometry;
+                asteroidGpuCuller.AddCommand(rock.indexType, rock.lods[0].indexCount, rock.GetFirstIndex(rock.lods[0]), rock.GetBaseVertex());
+            }
+        }
     }
 
+    //Texture sizes are only known once they have streamed in
+    bool textureStatsPrinted = false;
     while (!glfwWindowShouldClose(window))
     {
         //Calculate frame
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        GLState::Get().BeginFrame();
 
         //Process Input
         processInput(window);
 
+        //Background texture uploads
+        TextureStreamer::Get().Update();
+        TextureCache::Get().Trim();
+        if (!textureStatsPrinted && TextureStreamer::Get().GetPendingCount() == 0)
+        {
+            TextureCache::Get().PrintStats();
+            textureStatsPrinted = true;
+        }
+        VirtualTextureSystem::Get().Update();
+
         //Clear Things
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -419,36 +476,12 @@ int main()
         //Perspective elements            Field of View         Aspect ratio (Width:Height)          Zc    Zf
         glm::mat4 proj = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 200000.0f);
 
-        //Set camera view
-        glm::mat4 view = camera.GetViewMatrix();
-
         //World transform
         glm::mat4 model = glm::mat4(1.0f);
 
-
-
+        //The camera follows the ship, move it before anything is drawn
         if (space)
         {
-            //Light
-            lightModelShader.use();
-            lightModelShader.setVec3("viewPos", camera.Position);
-
-            //Sun Model
-            lightModelShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            lightModelShader.setMat4("view", view);
-            model3 = glm::rotate(model3, glm::radians(15 * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
-            lightModelShader.setMat4("model", model3);
-            sunModel.Draw(lightModelShader);
-
-
-            //Model
-            modelShader.use();
-            modelShader.setFloat("material.shininess", 32.0f);
-
-            //Model
-            modelShader.setMat4("projection", proj);
-
             if (shipMovement(window) == 1) //Move Forwards
             {
                 shipRotation = 0.0f;
@@ -456,7 +489,7 @@ int main()
                 camera.Position.x = model2[3].x;
                 camera.Position.y = model[3].y + 30.0f;
                 camera.Position.z = model2[3].z;
-                glEnable(GL_BLEND);
+                GLState::Get().Enable(GL_BLEND);
 
             }
             else if (shipMovement(window) == 2) //Move Backwards
@@ -520,126 +553,80 @@ int main()
                 }
                 model2 = glm::rotate(model2, glm::radians(shipRotation * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
             }
+        }
 
-            modelShader.setVec3("viewPos", camera.Position);
-            setStaticLights(modelShader);
-            setSpotlight(modelShader);
-            view = camera.GetViewMatrix();
-            modelShader.setMat4("view", view);
-            modelShader.setMat4("model", model2);
-            starDestroyerModel.Draw(modelShader);
+        //Camera and lights for every program, written once
+        glm::mat4 view = camera.GetViewMatrix();
+        CameraBlock cameraBlock = { proj, view, camera.Position, 0.0f };
+        FrameUniforms::Get().Update(cameraBlock, sceneLights());
+        Model::SetLodView(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT);
 
+        //Models are queued and drawn sorted by state and distance, those outside the view culled
+        renderQueue.Begin(camera.Position, proj * view);
 
-            //Gas Model
-            gasShader.use();
-            gasShader.setFloat("material.shininess", 32.0f);
-            gasShader.setVec3("viewPos", camera.Position);
+        if (space)
+        {
+            //Sun Model
+            model3 = glm::rotate(model3, glm::radians(15 * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
+            sunModel.SelectLod(model3);
+            sunModel.Submit(renderQueue, lightModelShader, model3);
+
+
+            //Model
+            starDestroyerModel.SelectLod(model2);
+            starDestroyerModel.Submit(renderQueue, litShaders, model2);
 
-            setStaticLights(gasShader);
-            setSpotlight(gasShader);
 
             //Gas Model
-            gasShader.setMat4("projection", proj);
             model4 = glm::translate(model4, glm::vec3(100.0f, 0.0, 100.0f));
             model4 = glm::rotate(model4, glm::radians(25 * deltaTime), glm::vec3(0.0f,1.0f, 0.0f));
             model4 = glm::translate(model4, glm::vec3(-100.0f, 0.0f, -100.0f));
 
 
 
-            view = camera.GetViewMatrix();
-            gasShader.setMat4("view", view);
-            gasShader.setMat4("model", model4);
-            gasModel.Draw(gasShader);
-
-            //Earth Model
-            earthShader.use();
-            earthShader.setFloat("material.shininess", 32.0f);
-            earthShader.setVec3("viewPos", camera.Position);
-
-            setStaticLights(earthShader);
-            setSpotlight(earthShader);
+            gasModel.SelectLod(model4);
+            gasModel.Submit(renderQueue, litShaders, model4);
 
             //Earth Model
-            earthShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            earthShader.setMat4("view", view);
             //model5 = glm::translate(model5, glm::vec3(-300.0f, 300.0f, 0.0f));
             model5 = glm::translate(model5, glm::vec3(200.0f, -200.0f, 0.0f));
             model5 = glm::rotate(model5, glm::radians(20 * deltaTime), glm::vec3(0.0f, 0.0f, -1.0f));
             model5 = glm::translate(model5, glm::vec3(-200.0f, 200.0f, 0.0f));
 
-            earthShader.setMat4("model", model5);
-            earthModel.Draw(earthShader);
+            earthModel.SelectLod(model5);
+            earthModel.Submit(renderQueue, litShaders, model5);
 
             //Red Model
-            redShader.use();
-            redShader.setFloat("material.shininess", 32.0f);
-            redShader.setVec3("viewPos", camera.Position);
-
-            setStaticLights(redShader);
-            setSpotlight(redShader);
-
-            //Red Model
-            redShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            redShader.setMat4("view", view);
             //model5 = glm::translate(model5, glm::vec3(-350.0f, 350.0f, 0.0f));
             model6 = glm::translate(model6, glm::vec3(350.0f, -350.0f, 0.0f));
             model6 = glm::rotate(model6, glm::radians(15 * deltaTime), glm::vec3(0.0f, 0.0f, -1.0f));
             model6 = glm::translate(model6, glm::vec3(-350.0f, 350.0f, 0.0f));
-            redShader.setMat4("model", model6);
-            redModel.Draw(redShader);
-
-            //Alien Model
-            alienShader.use();
-            alienShader.setFloat("material.shininess", 32.0f);
-            alienShader.setVec3("viewPos", camera.Position);
-
-            setStaticLights(alienShader);
-            setSpotlight(alienShader);
+            redModel.SelectLod(model6);
+            redModel.Submit(renderQueue, litShaders, model6);
 
             //Alien Model
-            alienShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            alienShader.setMat4("view", view);
             model7 = glm::translate(model7, glm::vec3(500.0f, 0.0f, -400.0f));
             model7 = glm::rotate(model7, glm::radians(10 * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
             model7 = glm::translate(model7, glm::vec3(-500.0f, 0.0f, 400.0f));
-            alienShader.setMat4("model", model7);
-            alienModel.Draw(alienShader);
-
-            //Sedna Model
-            sednaShader.use();
-            sednaShader.setFloat("material.shininess", 32.0f);
-            sednaShader.setVec3("viewPos", camera.Position);
-
-            setStaticLights(sednaShader);
-            setSpotlight(sednaShader);
+            alienModel.SelectLod(model7);
+            alienModel.Submit(renderQueue, litShaders, model7);
 
             //Sedna Model
-            sednaShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            sednaShader.setMat4("view", view);
             model8 = glm::translate(model8, glm::vec3(650.0f, 0.0f, 500.0f));
             model8 = glm::rotate(model8, glm::radians(5 * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
             model8 = glm::translate(model8, glm::vec3(-650.0f, 0.0f, -500.0f));
-            sednaShader.setMat4("model", model8);
-            sednaModel.Draw(sednaShader);
-
+            sednaModel.SelectLod(model8);
+            sednaModel.Submit(renderQueue, litShaders, model8);
+            renderQueue.Execute();
 
             //Always draw last
-            glDepthFunc(GL_LEQUAL);  //Make sure skybox doesn't overwrite objects
+            GLState::Get().DepthFunc(GL_LEQUAL);  //Make sure skybox doesn't overwrite objects
             skyboxShader.use();
-            glm::mat4 view2 = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-            skyboxShader.setMat4("view", view2);
-            skyboxShader.setMat4("projection", proj);
             //Skybox Cube
-            glBindVertexArray(skyboxVAO);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture->GetID());
+            GLState::Get().BindVertexArray(skyboxVAO);
+            GLState::Get().BindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture->GetID());
             glDrawArrays(GL_TRIANGLES, 0, 36);
-            glBindVertexArray(0);
-            glDepthFunc(GL_LESS); //Set back to usual mode for other objects
+            GLState::Get().DepthFunc(GL_LESS); //Set back to usual mode for other objects
 
 
 
@@ -690,52 +677,88 @@ int main()
         else
         {
             //Planet and Asteroid
-            asteroidShader.use();
-            asteroidShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            asteroidShader.setMat4("view", view);
-
-            asteroidPlanetShader.use();
-            asteroidPlanetShader.setMat4("projection", proj);
-            view = camera.GetViewMatrix();
-            asteroidPlanetShader.setMat4("view", view);
-
             // draw planet
             model9 = glm::rotate(model9, glm::radians(15 * deltaTime), glm::vec3(0.0f, 1.0f, 0.0f));
-            asteroidPlanetShader.setMat4("model", model9);
-            iceModel.Draw(asteroidPlanetShader);
-
-            // draw meteorites
+            iceModel.SelectLod(model9);
+            iceModel.Submit(renderQueue, asteroidPlanetShader, model9);
+            renderQueue.Execute();
+
+            // draw meteorites, culled in belt space so the stored spheres stay valid while the belt turns
+            glm::mat4 beltRotation = AsteroidInstance::BeltRotation(currentFrame, ASTEROID_ORBIT_SPEED);
+            Frustum beltFrustum(proj * view * beltRotation);
+            glm::vec3 beltViewPos = glm::vec3(glm::transpose(beltRotation) * glm::vec4(camera.Position, 1.0f));
+            bool gpuCulled = useGpuCulling && asteroidGpuCuller.IsSupported();
+            unsigned int asteroidsVisible = 0;
+            if (gpuCulled)
+                asteroidGpuCuller.Cull(beltFrustum, beltViewPos, ASTEROID_DRAW_DISTANCE);
+            else
+                asteroidsVisible = asteroidCuller.Cull(beltFrustum, beltViewPos, ASTEROID_DRAW_DISTANCE);
             asteroidShader.use();
-            asteroidShader.setInt("texture_diffuse1", 0);
+            asteroidShader.setInt("texture_diffuse1"_u, 0);
+            asteroidShader.setFloat("time"_u, currentFrame);
+            asteroidShader.setFloat("orbitSpeed"_u, ASTEROID_ORBIT_SPEED);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, asteroidModel.textures_loaded[0].id);
+            GLState::Get().BindTexture(0, GL_TEXTURE_2D, TextureStreamer::Get().Resolve(asteroidModel.textures_loaded[0].id));
+            GLState::Get().BindVertexArray(gpuCulled ? asteroidGpuVAO : asteroidVAO);
             for (unsigned int i = 0; i < asteroidModel.meshes.size(); i++)
             {
-                glBindVertexArray(asteroidModel.meshes[i].VAO);
-                glDrawElementsInstanced(GL_TRIANGLES, asteroidModel.meshes[i].indices.size(), GL_UNSIGNED_INT, 0, asteroidNum);
-                glBindVertexArray(0);
+                const MeshGeometry& rock = *asteroidModel.meshes[i].geometry;
+                rock.SetDecodeUniforms(asteroidShader);
+                if (gpuCulled)
+                    asteroidGpuCuller.Draw(i);
+                else if (asteroidsVisible > 0)
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, rock.lods[0].indexCount, rock.indexType, rock.GetIndexOffset(rock.lods[0]), asteroidsVisible, rock.GetBaseVertex());
             }
 
      
 
             //Always draw last
-            glDepthFunc(GL_LEQUAL);  //Make sure skybox doesn't overwrite objects
+            GLState::Get().DepthFunc(GL_LEQUAL);  //Make sure skybox doesn't overwrite objects
             skyboxShader.use();
-            glm::mat4 view2 = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-            skyboxShader.setMat4("view", view2);
-            skyboxShader.setMat4("projection", proj);
             //Skybox Cube
-            glBindVertexArray(skyboxVAO);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture->GetID());
+            GLState::Get().BindVertexArray(skyboxVAO);
+            GLState::Get().BindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture->GetID());
             glDrawArrays(GL_TRIANGLES, 0, 36);
-            glBindVertexArray(0);
-            glDepthFunc(GL_LESS); //Set back to usual mode for other objects
+            GLState::Get().DepthFunc(GL_LESS); //Set back to usual mode for other objects
         }
+        //Virtual texture feedback, which tiles the planets on screen need
+        VirtualTextureSystem::Get().BeginFeedback(SCR_WIDTH, SCR_HEIGHT);
+        vtFeedbackShader.use();
+        const Frustum& frustum = renderQueue.GetFrustum();
+        if (space)
+        {
+            if (frustum.IntersectsSphere(sunModel.boundsCenter, sunModel.boundsRadius, model3))
+            {
+                vtFeedbackShader.setMat4("model"_u, model3);
+                sunModel.Draw(vtFeedbackShader);
+            }
+        }
+        else if (frustum.IntersectsSphere(iceModel.boundsCenter, iceModel.boundsRadius, model9))
+        {
+            vtFeedbackShader.setMat4("model"_u, model9);
+            iceModel.Draw(vtFeedbackShader);
+        }
+        VirtualTextureSystem::Get().EndFeedback();
+
         int time = glfwGetTime();
         RenderText(textShader, "Elapsed time " + std::to_string(time), 10.0f, 10.0F, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
+
+        //Driver calls the state cache passed on and filtered out last frame
+        const GLState::Counters& glCalls = GLState::Get().GetLastFrame();
+        RenderText(textShader, "GL state calls " + std::to_string(glCalls.issued) + " issued, " + std::to_string(glCalls.skipped) + " skipped",
+            10.0f, 50.0f, 0.4f, glm::vec3(0.7f, 0.7f, 0.7f));
+        RenderText(textShader, "Meshes " + std::to_string(renderQueue.GetVisibleCount()) + " visible, " + std::to_string(renderQueue.GetCulledCount()) + " culled",
+            10.0f, 65.0f, 0.4f, glm::vec3(0.7f, 0.7f, 0.7f));
+        if (!space && useGpuCulling && asteroidGpuCuller.IsSupported())
+        {
+            RenderText(textShader, "Asteroids " + std::to_string(asteroidGpuCuller.GetVisibleCount()) + "/" + std::to_string(asteroidGpuCuller.GetInstanceCount()) + " visible (GPU culled, G for CPU)",
+                10.0f, 80.0f, 0.4f, glm::vec3(0.7f, 0.7f, 0.7f));
+        }
+        else if (!space)
+        {
+            RenderText(textShader, "Asteroids " + std::to_string(asteroidCuller.GetVisibleCount()) + "/" + std::to_string(asteroidCuller.GetInstanceCount()) + " visible (CPU culled)",
+                10.0f, 80.0f, 0.4f, glm::vec3(0.7f, 0.7f, 0.7f));
+        }
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -774,6 +797,12 @@ void processInput(GLFWwindow* window)
         }
     }
 
+    //Once per press
+    bool gpuCullingKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gpuCullingKey && !gpuCullingKeyDown)
+        useGpuCulling = !useGpuCulling;
+    gpuCullingKeyDown = gpuCullingKey;
+
 }
 
 
@@ -825,37 +854,42 @@ int shipMovement(GLFWwindow* window)
         return 0;
 }
 
-void setStaticLights(Shader shader)
+//Sun point light and the camera's spotlight, uploaded once a frame through FrameUniforms
+LightsBlock sceneLights()
 {
-    shader.setVec3("pointLights[0].position", glm::vec3(0.00f, 1.75f, 200.0f));
-    shader.setVec3("pointLights[0].ambient", glm::vec3(0.0f, 0.0f, 0.0f));
-    shader.setVec3("pointLights[0].diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-    shader.setVec3("pointLights[0].specular", glm::vec3(1.0f, 1.0f, 1.0f));
-    shader.setFloat("pointLights[0].constant", 1.0f);
-    shader.setFloat("pointLights[0].linear", 0.000000000014);
-    shader.setFloat("pointLights[0].quadratic", 0.00000000000007);
+    LightsBlock lights = {};
+
+    //No directional light, a downward direction keeps the maths finite
+    lights.dirLight.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+
+    lights.pointLights[0].position = glm::vec3(0.00f, 1.75f, 200.0f);
+    lights.pointLights[0].ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.pointLights[0].diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.pointLights[0].specular = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.pointLights[0].constant = 1.0f;
+    lights.pointLights[0].linear = 0.000000000014f;
+    lights.pointLights[0].quadratic = 0.00000000000007f;
+
+    lights.spotLight.position = camera.Position;
+    lights.spotLight.direction = camera.Front;
+    lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.spotLight.constant = 1.0f;
+    lights.spotLight.linear = 0.000007f;
+    lights.spotLight.quadratic = 0.0000002f;
+    lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+    lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+    return lights;
 }
 
-void setSpotlight(Shader shader)
-{
-    shader.setVec3("spotLight.position", camera.Position);
-    shader.setVec3("spotLight.direction", camera.Front);
-    shader.setVec3("spotLight.ambient", glm::vec3(0.0f, 0.0f, 0.0f));
-    shader.setVec3("spotLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-    shader.setVec3("spotLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-    shader.setFloat("spotLight.constant", 1.0f);
-    shader.setFloat("spotLight.linear", 0.000007);
-    shader.setFloat("spotLight.quadratic", 0.0000002);
-    shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-    shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-}
-
-void RenderText(Shader shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
+void RenderText(const Shader& shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
 {
     shader.use();
-    shader.setVec3("textColor", color);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(textVAO);
+    shader.setVec3("textColor"_u, color);
+    GLState::Get().BindVertexArray(textVAO);
+    GLState::Get().BindArrayBuffer(textVBO);
+    GLState::Get().Disable(GL_DEPTH_TEST);
 
     //Iterate through characters
     std::string::const_iterator c;
@@ -880,25 +914,18 @@ void RenderText(Shader shader, std::string text, GLfloat x, GLfloat y, GLfloat s
             {xpos + w, ypos + h, 1.0f, 0.0f}
         };
 
-        glDisable(GL_DEPTH_TEST);
-
         //Render Glyph
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
+        GLState::Get().BindTexture(0, GL_TEXTURE_2D, ch.TextureID);
 
         //Update VBO Memory
-        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
         glDrawArrays(GL_TRIANGLES, 0, 6);
 
         //Advance to next glyph
         //Bitshift by 6
         x += (ch.Advance >> 6) * scale;
     }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glEnable(GL_DEPTH_TEST);
+    GLState::Get().Enable(GL_DEPTH_TEST);
 }
 
 int updatePlanetCam(GLFWwindow* window)